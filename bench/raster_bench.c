@@ -0,0 +1,400 @@
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "display.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "span.h"
+#include "texture.h"
+#include "triangle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Rasterizer microbenchmark
+///////////////////////////////////////////////////////////////////////////////
+//
+// Calls the drawing functions directly, without the rest of the frame, over
+// sets of triangles with different sizes and shapes:
+//
+//   tiny     sub-pixel triangles
+//   small    triangles of about 10 pixels
+//   medium   triangles of about 300 pixels
+//   sliver   long triangles one pixel wide
+//   large    triangles covering half of the screen
+//   NAME     the front faces of ./assets/NAME.obj projected like the renderer
+//            does on its first frame
+//
+// The synthetic triangles are drawn back to front so every pixel passes the
+// depth test, the asset triangles in mesh order with their real depth. Every
+// set is drawn again and again, with the depth buffer cleared in between and
+// not timed, for at least the given time.
+//
+// Pixels are counted as the area of the triangles, and as the pixels the DDA
+// steps through for lines, whether they pass the depth test or not.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  char name[32];
+  triangle_t* triangles;
+  int count;
+} workload_t;
+
+typedef enum {
+  BENCH_FILLED,     // draw_filled_triangle
+  BENCH_TEXTURED,   // draw_textured_triangle
+  BENCH_WIREFRAME,  // draw_triangle
+  BENCH_LINE,       // draw_line along the first edge
+  BENCH_NUM_FUNCTIONS
+} bench_function_t;
+
+char* bench_function_names[BENCH_NUM_FUNCTIONS] = {"filled", "textured",
+                                                   "wireframe", "line"};
+
+char* asset_names[] = {"crab", "drone", "f22", "efa", "f117", "sphere"};
+#define NUM_ASSETS (int)(sizeof(asset_names) / sizeof(asset_names[0]))
+
+double min_seconds = 0.5;
+uint32_t random_state = 12345;
+
+// Deterministic generator, so every run draws the same triangles
+float random_float(float min, float max) {
+  random_state = random_state * 1664525u + 1013904223u;
+  return min + (max - min) * (random_state >> 8) / (float)(1 << 24);
+}
+
+float triangle_area(triangle_t* triangle) {
+  screen_point_t* p = triangle->points;
+  return fabsf((p[1].x - p[0].x) * (p[2].y - p[0].y) -
+               (p[2].x - p[0].x) * (p[1].y - p[0].y)) /
+         2;
+}
+
+// Pixels draw_line steps through from a to b
+int line_pixels(screen_point_t a, screen_point_t b) {
+  int dx = abs((int)b.x - (int)a.x);
+  int dy = abs((int)b.y - (int)a.y);
+  return (dx > dy ? dx : dy) + 1;
+}
+
+triangle_t make_triangle(float x0, float y0, float x1, float y1, float x2,
+                         float y2) {
+  triangle_t triangle = {
+      .points = {{x0, y0, 1}, {x1, y1, 1}, {x2, y2, 1}},
+      .texcoords = {{0, 0}, {1, 0}, {0, 1}},
+      .color = 0xFFFFFFFF};
+  return triangle;
+}
+
+// Give the triangles decreasing depths, so every one is drawn over the
+// previous ones and passes the depth test
+void order_back_to_front(workload_t* workload) {
+  for (int i = 0; i < workload->count; i++) {
+    float w = 100 - 99 * (float)i / workload->count;
+    for (int j = 0; j < 3; j++) {
+      workload->triangles[i].points[j].w = w;
+    }
+  }
+}
+
+// Triangles with their vertices at a random distance up to radius from a
+// random center on the screen
+workload_t make_random_workload(char* name, int count, float radius) {
+  workload_t workload;
+  snprintf(workload.name, sizeof(workload.name), "%s", name);
+  workload.triangles = (triangle_t*)malloc(sizeof(triangle_t) * count);
+  workload.count = count;
+
+  for (int i = 0; i < count; i++) {
+    float cx = random_float(radius, window_width - 1 - radius);
+    float cy = random_float(radius, window_height - 1 - radius);
+    float points[6];
+    for (int j = 0; j < 3; j++) {
+      float angle = random_float(0, 2 * M_PI);
+      float distance = random_float(radius / 2, radius);
+      points[2 * j] = cx + cosf(angle) * distance;
+      points[2 * j + 1] = cy + sinf(angle) * distance;
+    }
+    workload.triangles[i] = make_triangle(points[0], points[1], points[2],
+                                          points[3], points[4], points[5]);
+  }
+  order_back_to_front(&workload);
+  return workload;
+}
+
+// Triangles 100 to 400 pixels long and about one pixel wide
+workload_t make_sliver_workload(int count) {
+  workload_t workload = {"sliver", NULL, count};
+  workload.triangles = (triangle_t*)malloc(sizeof(triangle_t) * count);
+
+  for (int i = 0; i < count; i++) {
+    float length = random_float(100, 400);
+    float angle = random_float(0, 2 * M_PI);
+    float dx = cosf(angle);
+    float dy = sinf(angle);
+    float x0 = random_float(0, window_width - 1);
+    float y0 = random_float(0, window_height - 1);
+    float x1 = x0 + dx * length;
+    float y1 = y0 + dy * length;
+    // keep the far end on the screen by mirroring it around the start
+    if (x1 < 0 || x1 > window_width - 1) x1 = x0 - dx * length;
+    if (y1 < 0 || y1 > window_height - 1) y1 = y0 - dy * length;
+    if (x1 < 0) x1 = 0;
+    if (x1 > window_width - 1) x1 = window_width - 1;
+    if (y1 < 0) y1 = 0;
+    if (y1 > window_height - 1) y1 = window_height - 1;
+
+    float width = random_float(0.5, 1.5);
+    workload.triangles[i] =
+        make_triangle(x0, y0, x1, y1, x0 - dy * width, y0 + dx * width);
+  }
+  order_back_to_front(&workload);
+  return workload;
+}
+
+// Triangles with a vertex near three corners of the screen
+workload_t make_large_workload(int count) {
+  workload_t workload = {"large", NULL, count};
+  workload.triangles = (triangle_t*)malloc(sizeof(triangle_t) * count);
+
+  float w = window_width - 1;
+  float h = window_height - 1;
+  for (int i = 0; i < count; i++) {
+    float jitter = 0.05;
+    float x0 = random_float(0, w * jitter);
+    float y0 = random_float(0, h * jitter);
+    float x1 = random_float(w * (1 - jitter), w);
+    float y1 = random_float(0, h * jitter);
+    float x2 = random_float(0, w * jitter);
+    float y2 = random_float(h * (1 - jitter), h);
+    workload.triangles[i] = i % 2 ? make_triangle(x0, y0, x1, y1, x2, y2)
+                                  : make_triangle(w - x0, h - y0, w - x1,
+                                                  h - y1, w - x2, h - y2);
+  }
+  order_back_to_front(&workload);
+  return workload;
+}
+
+// Project the front faces of an asset with the camera, projection and
+// viewport of the renderer, the mesh 5 units in front of the camera
+workload_t make_asset_workload(char* name) {
+  workload_t workload = {"", NULL, 0};
+  snprintf(workload.name, sizeof(workload.name), "%s", name);
+
+  char filename[256];
+  snprintf(filename, sizeof(filename), "./assets/%s.obj", name);
+  free_mesh();
+  load_obj_file_data(filename);
+
+  float aspect = (float)window_height / (float)window_width;
+  mat4_t proj_matrix = mat4_make_perspective(M_PI / 3.0, aspect, 0.1, 100);
+  mat4_t world_matrix = mat4_make_translation(0, 0, 5);
+
+  int num_faces = array_length(mesh.faces);
+  workload.triangles = (triangle_t*)malloc(sizeof(triangle_t) * num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    int indices[3] = {mesh.faces[i].a, mesh.faces[i].b, mesh.faces[i].c};
+    vec3_t camera_points[3];
+    triangle_t triangle;
+    for (int j = 0; j < 3; j++) {
+      vec4_t vertex = vec4_from_vec3(mesh.vertices[indices[j]]);
+      vertex = mat4_mul_vec4(world_matrix, vertex);
+      camera_points[j] = vec3_from_vec4(vertex);
+
+      vec4_t projected = mat4_mul_vec4_project(proj_matrix, vertex);
+      triangle.points[j].x = projected.x * (window_width / 2.0) +
+                             (window_width / 2.0);
+      triangle.points[j].y = -projected.y * (window_height / 2.0) +
+                             (window_height / 2.0);
+      triangle.points[j].w = projected.w;
+      triangle.texcoords[j] = mesh.texcoords[indices[j]];
+    }
+
+    vec3_t normal =
+        vec3_cross(vec3_sub(camera_points[1], camera_points[0]),
+                   vec3_sub(camera_points[2], camera_points[0]));
+    if (vec3_dot(normal, vec3_mul(camera_points[0], -1)) < 0) {
+      continue;  // back face
+    }
+    triangle.color = 0xFFFFFFFF;
+    workload.triangles[workload.count++] = triangle;
+  }
+  return workload;
+}
+
+// Print how many triangles of a workload fall in every range of areas
+void print_area_histogram(workload_t* workload) {
+  float limits[] = {1, 4, 16, 64, 256, 1024, 4096};
+  int num_limits = sizeof(limits) / sizeof(limits[0]);
+  int counts[sizeof(limits) / sizeof(limits[0]) + 1] = {0};
+  for (int i = 0; i < workload->count; i++) {
+    float area = triangle_area(&workload->triangles[i]);
+    int bucket = 0;
+    while (bucket < num_limits && area >= limits[bucket]) bucket++;
+    counts[bucket]++;
+  }
+
+  printf("%-10s", workload->name);
+  for (int i = 0; i <= num_limits; i++) {
+    printf(" %7.1f%%",
+           workload->count ? 100.0 * counts[i] / workload->count : 0.0);
+  }
+  printf("\n");
+}
+
+void draw_workload(workload_t* workload, bench_function_t function) {
+  for (int i = 0; i < workload->count; i++) {
+    screen_point_t* p = workload->triangles[i].points;
+    tex2_t* t = workload->triangles[i].texcoords;
+    uint32_t color = workload->triangles[i].color;
+    switch (function) {
+      case BENCH_FILLED:
+        draw_filled_triangle(p[0].x, p[0].y, p[0].w, p[1].x, p[1].y, p[1].w,
+                             p[2].x, p[2].y, p[2].w, color);
+        break;
+      case BENCH_TEXTURED:
+        draw_textured_triangle(p[0].x, p[0].y, p[0].w, t[0].u, t[0].v, p[1].x,
+                               p[1].y, p[1].w, t[1].u, t[1].v, p[2].x, p[2].y,
+                               p[2].w, t[2].u, t[2].v, mesh_texture);
+        break;
+      case BENCH_WIREFRAME:
+        draw_triangle(p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, color);
+        break;
+      default:
+        draw_line(p[0].x, p[0].y, p[1].x, p[1].y, color);
+        break;
+    }
+  }
+}
+
+// Pixels one pass over the workload touches with a function
+double workload_pixels(workload_t* workload, bench_function_t function) {
+  double pixels = 0;
+  for (int i = 0; i < workload->count; i++) {
+    screen_point_t* p = workload->triangles[i].points;
+    if (function == BENCH_FILLED || function == BENCH_TEXTURED) {
+      pixels += triangle_area(&workload->triangles[i]);
+    } else if (function == BENCH_WIREFRAME) {
+      pixels += line_pixels(p[0], p[1]) + line_pixels(p[1], p[2]) +
+                line_pixels(p[2], p[0]);
+    } else {
+      pixels += line_pixels(p[0], p[1]);
+    }
+  }
+  return pixels;
+}
+
+void run_workload(workload_t* workload, bench_function_t function) {
+  if (workload->count == 0) {
+    return;
+  }
+
+  double frequency = SDL_GetPerformanceFrequency();
+  double seconds = 0;
+  int passes = 0;
+  while (seconds < min_seconds) {
+    clear_color_buffer(0xFF000000);
+    clear_z_buffer();
+    uint64_t start = SDL_GetPerformanceCounter();
+    draw_workload(workload, function);
+    seconds += (SDL_GetPerformanceCounter() - start) / frequency;
+    passes++;
+  }
+
+  double triangles = (double)workload->count * passes;
+  double pixels = workload_pixels(workload, function) * passes;
+  printf("%-10s %-10s %9d %10.3f %10.2f %10.2f\n", workload->name,
+         bench_function_names[function], workload->count,
+         seconds * 1000 / passes, triangles / seconds / 1e6,
+         pixels / seconds / 1e6);
+}
+
+void print_usage(char* program) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --size WxH        framebuffer size (default 800x600)\n"
+      "  --kernel NAME     span kernels: scalar, sse2 or avx2\n"
+      "                    (default: the fastest the CPU supports)\n"
+      "  --time SECONDS    minimum time per benchmark (default 0.5)\n"
+      "  --filter NAME     only run the workload NAME\n",
+      program);
+}
+
+int main(int argc, char* argv[]) {
+  int width = 800;
+  int height = 600;
+  char* kernel = NULL;
+  char* filter = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    char* arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (strcmp(arg, "--size") == 0 && has_value) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 ||
+          height <= 0) {
+        fprintf(stderr, "Invalid size %s, expected WxH.\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--kernel") == 0 && has_value) {
+      kernel = argv[++i];
+    } else if (strcmp(arg, "--time") == 0 && has_value) {
+      min_seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--filter") == 0 && has_value) {
+      filter = argv[++i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!initialize_headless(width, height)) {
+    return 1;
+  }
+  create_frame_buffers();
+  load_png_texture_data("./assets/crab.png");
+  initialize_span_kernels(kernel);
+
+  workload_t workloads[5 + NUM_ASSETS];
+  int num_workloads = 0;
+  workloads[num_workloads++] = make_random_workload("tiny", 100000, 0.5);
+  workloads[num_workloads++] = make_random_workload("small", 50000, 3);
+  workloads[num_workloads++] = make_random_workload("medium", 10000, 16);
+  workloads[num_workloads++] = make_sliver_workload(5000);
+  workloads[num_workloads++] = make_large_workload(100);
+  for (int i = 0; i < NUM_ASSETS; i++) {
+    workloads[num_workloads++] = make_asset_workload(asset_names[i]);
+  }
+  free_mesh();
+
+  printf("%dx%d, %s kernels, at least %.2f s per benchmark\n\n", width,
+         height, span_kernel_name, min_seconds);
+
+  printf("Triangle areas in pixels:\n");
+  printf("%-10s %8s %8s %8s %8s %8s %8s %8s %8s\n", "workload", "<1", "1-4",
+         "4-16", "16-64", "64-256", "256-1K", "1K-4K", ">=4K");
+  for (int i = 0; i < num_workloads; i++) {
+    print_area_histogram(&workloads[i]);
+  }
+
+  printf("\n%-10s %-10s %9s %10s %10s %10s\n", "workload", "function",
+         "triangles", "ms/pass", "Mtri/s", "Mpix/s");
+  for (int i = 0; i < num_workloads; i++) {
+    if (filter && strcmp(filter, workloads[i].name) != 0) continue;
+    for (int f = 0; f < BENCH_NUM_FUNCTIONS; f++) {
+      run_workload(&workloads[i], f);
+    }
+  }
+
+  for (int i = 0; i < num_workloads; i++) {
+    free(workloads[i].triangles);
+  }
+  upng_free(png_texture);
+  destroy_frame_buffers();
+  destroy_window();
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include "array.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -8,35 +9,56 @@
 #define ARRAY_CAPACITY(array) (ARRAY_RAW_DATA(array)[0])
 #define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
 
+// Make room for count more elements. Returns NULL when the memory can not be
+// allocated, the array passed in is then left untouched.
 void* array_hold(void* array, int count, int item_size) {
-  if (array == NULL) {
-    int raw_size = (sizeof(int) * 2) + (item_size * count);
-    int* base = (int*)malloc(raw_size);
-    base[0] = count;  // capacity
-    base[1] = count;  // occupied
-    return base + 2;
-  } else if (ARRAY_OCCUPIED(array) + count <= ARRAY_CAPACITY(array)) {
-    ARRAY_OCCUPIED(array) += count;
+  size_t occupied = array ? (size_t)ARRAY_OCCUPIED(array) : 0;
+  size_t capacity = array ? (size_t)ARRAY_CAPACITY(array) : 0;
+  size_t needed = occupied + (size_t)count;
+  if (needed > INT_MAX) {
+    fprintf(stderr, "Error growing an array past %d elements.\n", INT_MAX);
+    return NULL;
+  }
+  if (array != NULL && needed <= capacity) {
+    ARRAY_OCCUPIED(array) = (int)needed;
     return array;
-  } else {
-    int needed_size = ARRAY_OCCUPIED(array) + count;
-    int double_curr = ARRAY_CAPACITY(array) * 2;
-    int capacity = needed_size > double_curr ? needed_size : double_curr;
-    int occupied = needed_size;
-    int raw_size = sizeof(int) * 2 + item_size * capacity;
-    int* base = (int*)realloc(ARRAY_RAW_DATA(array), raw_size);
-    base[0] = capacity;
-    base[1] = occupied;
-    return base + 2;
   }
+
+  // Grow to twice the capacity, or just enough for a new array
+  size_t double_curr = capacity * 2;
+  if (double_curr > INT_MAX) double_curr = INT_MAX;
+  capacity = needed > double_curr ? needed : double_curr;
+  size_t raw_size = ARRAY_HEADER_SIZE + (size_t)item_size * capacity;
+  int* base = (int*)realloc(array ? ARRAY_RAW_DATA(array) : NULL, raw_size);
+  if (base == NULL) {
+    fprintf(stderr, "Error allocating an array of %zu bytes.\n", raw_size);
+    return NULL;
+  }
+  base[0] = (int)capacity;
+  base[1] = (int)needed;
+  return base + 2;
 }
 
 int array_length(void* array) {
   return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
 
+// Empty the array but keep its capacity, so refilling it does not reallocate
+void array_reset(void* array) {
+  if (array != NULL) {
+    ARRAY_OCCUPIED(array) = 0;
+  }
+}
+
+// Write the header of a full array of count elements, for arrays that are
+// stored in a file and used in place without being allocated by array_hold
+void array_write_header(void* header, int count) {
+  ((int*)header)[0] = count;  // capacity
+  ((int*)header)[1] = count;  // occupied
+}
+
 void array_free(void* array) {
   if (array != NULL) {
     free(ARRAY_RAW_DATA(array));
   }
-}
\ No newline at end of file
+}
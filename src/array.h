@@ -1,14 +1,23 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
-#define array_push(array, value)                        \
-  do {                                                  \
-    (array) = array_hold((array), 1, sizeof(*(array))); \
-    (array)[array_length(array) - 1] = (value);         \
+// Append a value, the array is left as it was when it can not grow
+#define array_push(array, value)                                 \
+  do {                                                           \
+    void* array_held = array_hold((array), 1, sizeof(*(array))); \
+    if (array_held) {                                            \
+      (array) = array_held;                                      \
+      (array)[array_length(array) - 1] = (value);                \
+    }                                                            \
   } while (0);
 
+// Size of the header (capacity and length) stored in front of the elements
+#define ARRAY_HEADER_SIZE (2 * sizeof(int))
+
 void* array_hold(void* array, int count, int item_size);
+void array_write_header(void* header, int count);
 int array_length(void* array);
+void array_reset(void* array);
 void array_free(void* array);
 
 #endif
\ No newline at end of file
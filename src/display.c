@@ -2,11 +2,27 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLEAR_X86_SIMD
+#include <immintrin.h>
+#endif
 
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
 uint32_t *color_buffer = NULL;
+framebuffer_t framebuffer = {NULL, 0};
+bool framebuffer_locked = false;
 float *z_buffer = NULL;
+uint32_t *visibility_buffer = NULL;
+float *hiz_buffer = NULL;
+uint8_t *hiz_dirty = NULL;
+uint32_t *hiz_epoch = NULL;
+uint32_t depth_epoch = 0;
+int hiz_width = 0;
+int hiz_height = 0;
 SDL_Texture *color_buffer_texture = NULL;
 int window_width = 800;
 int window_height = 600;
@@ -16,6 +32,9 @@ bool RENDER_WIREFRAME = true;
 bool RENDER_FILL = true;
 bool RENDER_VERTICES = true;
 bool RENDER_TEXTURED = false;
+bool USE_VISIBILITY_BUFFER = false;
+bool LAZY_DEPTH_CLEAR = false;
+bool ZERO_COPY_PRESENT = true;
 
 bool initialize_window(void) {
   if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
@@ -54,24 +73,99 @@ bool initialize_window(void) {
   return true;
 }
 
+// Initialize SDL without the video subsystem so the renderer can run on
+// machines that have no display; frames only ever live in the color buffer
+bool initialize_headless(int width, int height) {
+  if (SDL_Init(SDL_INIT_TIMER) != 0) {
+    fprintf(stderr, "Error initializing SDL.\n");
+    return false;
+  }
+
+  window_width = width;
+  window_height = height;
+
+  return true;
+}
+
+// Allocate the color, depth, hierarchical depth and visibility buffers for
+// the current window size
+void create_frame_buffers(void) {
+  // allocate the required memory in bytes to hold the color buffer
+  color_buffer =
+      (uint32_t *)malloc(sizeof(uint32_t) * window_width * window_height);
+  framebuffer.pixels = color_buffer;
+  framebuffer.pitch = window_width;
+  z_buffer = (float *)malloc(
+      sizeof(float) * window_width *
+      window_height);  // (float *) -> means casting to float value
+
+  // allocate the hierarchical z-buffer, one depth value per block of pixels
+  hiz_width = (window_width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+  hiz_height = (window_height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+  hiz_buffer = (float *)malloc(sizeof(float) * hiz_width * hiz_height);
+  hiz_dirty = (uint8_t *)malloc(hiz_width * hiz_height);
+  hiz_epoch = (uint32_t *)calloc(hiz_width * hiz_height, sizeof(uint32_t));
+
+  // the visibility buffer starts empty and the shading pass keeps it empty
+  visibility_buffer =
+      (uint32_t *)calloc(window_width * window_height, sizeof(uint32_t));
+}
+
+void destroy_frame_buffers(void) {
+  free(color_buffer);  // free memory, free is opposite of malloc
+  free(z_buffer);
+  free(hiz_buffer);
+  free(hiz_dirty);
+  free(hiz_epoch);
+  free(visibility_buffer);
+  color_buffer = NULL;
+  framebuffer.pixels = NULL;
+  z_buffer = NULL;
+  hiz_buffer = NULL;
+  hiz_dirty = NULL;
+  hiz_epoch = NULL;
+  visibility_buffer = NULL;
+}
+
+// Draw the full rows of the grid and only visit the pixels of its columns in
+// the rows in between
 void draw_grid(uint32_t color, int gap_size) {
   for (int y = 0; y < window_height; y++) {
-    for (int x = 0; x < window_width; x++) {
-      if (x % gap_size != 0 && y % gap_size != 0) continue;
-      color_buffer[window_width * y + x] = color;
+    uint32_t *row = framebuffer.pixels + framebuffer.pitch * y;
+    if (y % gap_size == 0) {
+      fill_buffer(row, color, window_width);
+      continue;
+    }
+    for (int x = 0; x < window_width; x += gap_size) {
+      row[x] = color;
     }
   }
 }
 
 void draw_pixel(int x, int y, uint32_t color) {
   if (x >= 0 && x < window_width && y >= 0 && y < window_height) {
-    color_buffer[window_width * y + x] = color;
+    framebuffer.pixels[framebuffer.pitch * y + x] = color;
   };
 }
 
 // DDA algorithm:
 // https://en.wikipedia.org/wiki/Digital_differential_analyzer_(graphics_algorithm)
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
+  draw_line_clipped(x0, y0, x1, y1, color, screen_rect());
+}
+
+void draw_rect(int xCoord, int yCoord, int width, int height, uint32_t color) {
+  draw_rect_clipped(xCoord, yCoord, width, height, color, screen_rect());
+}
+
+rect_t screen_rect(void) {
+  rect_t rect = {0, 0, window_width - 1, window_height - 1};
+  return rect;
+}
+
+// Same as draw_line, but only the pixels inside the clip rectangle are drawn
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color,
+                       rect_t clip) {
   int delta_x = (x1 - x0);
   int delta_y = (y1 - y0);
 
@@ -88,57 +182,323 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
   float current_y = y0;
 
   for (int i = 0; i <= longest_side_length; i++) {
-    draw_pixel(round(current_x), round(current_y), color);
+    int x = round(current_x);
+    int y = round(current_y);
+    if (x >= clip.min_x && x <= clip.max_x && y >= clip.min_y &&
+        y <= clip.max_y) {
+      framebuffer.pixels[framebuffer.pitch * y + x] = color;
+    }
     current_x += x_inc;
     current_y += y_inc;
   }
 }
 
-void draw_rect(int xCoord, int yCoord, int width, int height, uint32_t color) {
+// Same as draw_rect, but only the pixels inside the clip rectangle are drawn
+void draw_rect_clipped(int xCoord, int yCoord, int width, int height,
+                       uint32_t color, rect_t clip) {
   // more performant way to draw rect as it's not looping over every pixel
   // calculations here just starts from the initial coordinates of the rect
   // and fill every pixel with color until rect's width and height are met
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      int current_x = xCoord + i;
-      int current_y = yCoord + j;
-      draw_pixel(current_x, current_y, color);
+  int min_x = xCoord > clip.min_x ? xCoord : clip.min_x;
+  int min_y = yCoord > clip.min_y ? yCoord : clip.min_y;
+  int max_x = xCoord + width - 1 < clip.max_x ? xCoord + width - 1 : clip.max_x;
+  int max_y =
+      yCoord + height - 1 < clip.max_y ? yCoord + height - 1 : clip.max_y;
+
+  for (int y = min_y; y <= max_y; y++) {
+    for (int x = min_x; x <= max_x; x++) {
+      framebuffer.pixels[framebuffer.pitch * y + x] = color;
     }
   }
-  // for (int y = 0; y < window_height; y++) {
-  //   for (int x = 0; x < window_width; x++) {
-  //     if (y >= yCoord && y <= (yCoord + height) &&
-  //         (x >= xCoord && x <= (xCoord + width))) {
-  //       color_buffer[(window_width * y) + x] = color;
-  //     }
-  //   }
-  // }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Zero-copy presentation
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copying the color buffer into the texture every frame costs a full-frame
+// memory pass, several milliseconds at 4K. With ZERO_COPY_PRESENT the frame
+// is drawn straight into the memory of the locked streaming texture instead,
+// and unlocking it hands the pixels over to SDL. The locked memory is write
+// only and its content is undefined, which is fine because every frame
+// starts with a clear. If the texture can not be locked, the frame is drawn
+// into the color buffer and copied as before.
+//
+///////////////////////////////////////////////////////////////////////////////
+void lock_framebuffer(void) {
+  framebuffer.pixels = color_buffer;
+  framebuffer.pitch = window_width;
+  if (!ZERO_COPY_PRESENT || !color_buffer_texture) {
+    return;
+  }
+
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch) != 0) {
+    return;
+  }
+  framebuffer.pixels = (uint32_t *)pixels;
+  framebuffer.pitch = pitch / (int)sizeof(uint32_t);
+  framebuffer_locked = true;
 }
 
 void render_color_buffer(void) {
-  SDL_UpdateTexture(color_buffer_texture, NULL, color_buffer,
+  if (framebuffer_locked) {
+    SDL_UnlockTexture(color_buffer_texture);
+    framebuffer_locked = false;
+    framebuffer.pixels = color_buffer;
+    framebuffer.pitch = window_width;
+    SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+  } else {
+    render_pixels(color_buffer);
+  }
+}
+
+// Copy a frame of window_width x window_height pixels into the texture and
+// render it
+void render_pixels(uint32_t *pixels) {
+  SDL_UpdateTexture(color_buffer_texture, NULL, pixels,
                     (int)(window_width * sizeof(uint32_t)));
   SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Buffer clears
+///////////////////////////////////////////////////////////////////////////////
+//
+// The clears write 16 bytes per store with SSE2. Buffers bigger than
+// CLEAR_STREAMING_BYTES do not fit in the caches anyway, so they are written
+// with non-temporal stores, which go straight to memory without first
+// reading every cache line they overwrite.
+//
+///////////////////////////////////////////////////////////////////////////////
+#define CLEAR_STREAMING_BYTES (1024 * 1024)
+
+#ifdef CLEAR_X86_SIMD
+
+__attribute__((target("sse2"))) void fill_buffer_sse2(uint32_t *buffer,
+                                                     uint32_t value,
+                                                     size_t count) {
+  // Align the vector stores to 16 bytes
+  size_t i = 0;
+  for (; i < count && ((uintptr_t)(buffer + i) & 15) != 0; i++) {
+    buffer[i] = value;
+  }
+
+  __m128i values = _mm_set1_epi32(value);
+  if (count * sizeof(uint32_t) >= CLEAR_STREAMING_BYTES) {
+    for (; i + 16 <= count; i += 16) {
+      _mm_stream_si128((__m128i *)(buffer + i), values);
+      _mm_stream_si128((__m128i *)(buffer + i + 4), values);
+      _mm_stream_si128((__m128i *)(buffer + i + 8), values);
+      _mm_stream_si128((__m128i *)(buffer + i + 12), values);
+    }
+    // Make the streaming stores visible before the tile workers read them
+    _mm_sfence();
+  }
+  for (; i + 4 <= count; i += 4) {
+    _mm_store_si128((__m128i *)(buffer + i), values);
+  }
+
+  for (; i < count; i++) {
+    buffer[i] = value;
+  }
+}
+
+#endif
+
+// Set count 32-bit values of buffer to value
+void fill_buffer(uint32_t *buffer, uint32_t value, size_t count) {
+#ifdef CLEAR_X86_SIMD
+  if (SDL_HasSSE2()) {
+    fill_buffer_sse2(buffer, value, count);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; i++) {
+    buffer[i] = value;
+  }
+}
+
 void clear_color_buffer(uint32_t color) {
+  if (framebuffer.pitch == window_width) {
+    fill_buffer(framebuffer.pixels, color,
+                (size_t)window_width * window_height);
+    return;
+  }
   for (int y = 0; y < window_height; y++) {
-    for (int x = 0; x < window_width; x++) {
-      color_buffer[window_width * y + x] = color;
-    }
+    fill_buffer(framebuffer.pixels + framebuffer.pitch * y, color,
+                window_width);
   }
 }
 
 void clear_z_buffer(void) {
+  uint32_t far_depth;
+  float one = 1.0;
+  memcpy(&far_depth, &one, sizeof(far_depth));
+  fill_buffer((uint32_t *)z_buffer, far_depth,
+              (size_t)window_width * window_height);
+
+  for (int i = 0; i < hiz_width * hiz_height; i++) {
+    hiz_buffer[i] = 1.0;
+    hiz_epoch[i] = depth_epoch;
+  }
+  memset(hiz_dirty, 0, hiz_width * hiz_height);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lazy depth clear with per-block epochs
+///////////////////////////////////////////////////////////////////////////////
+//
+// With LAZY_DEPTH_CLEAR the z-buffer is not cleared between frames. Every
+// block of the hierarchical z-buffer is tagged with the epoch (frame) it was
+// last cleared in, and starting a frame only increments depth_epoch. The
+// rasterizer calls prepare_hiz_block() before it tests or draws a block, which
+// clears the depths of the block the first time it is touched in the frame.
+// Blocks no triangle touches are never written at all. Blocks never straddle
+// screen tiles, so the tile workers never prepare the same block.
+//
+///////////////////////////////////////////////////////////////////////////////
+void reset_z_buffer(void) {
+  if (LAZY_DEPTH_CLEAR) {
+    depth_epoch++;
+    if (depth_epoch == 0) {
+      clear_z_buffer();  // the epoch wrapped around, old tags would match
+    }
+  } else {
+    clear_z_buffer();
+  }
+}
+
+void prepare_hiz_block(int block_x, int block_y) {
+  int block = hiz_width * block_y + block_x;
+  if (hiz_epoch[block] == depth_epoch) {
+    return;
+  }
+
+  int x_start = block_x * HIZ_BLOCK_SIZE;
+  int y_start = block_y * HIZ_BLOCK_SIZE;
+  int x_end = x_start + HIZ_BLOCK_SIZE;
+  int y_end = y_start + HIZ_BLOCK_SIZE;
+  if (x_end > window_width) x_end = window_width;
+  if (y_end > window_height) y_end = window_height;
+
+  for (int y = y_start; y < y_end; y++) {
+    for (int x = x_start; x < x_end; x++) {
+      z_buffer[window_width * y + x] = 1.0;
+    }
+  }
+
+  hiz_buffer[block] = 1.0;
+  hiz_dirty[block] = 0;
+  hiz_epoch[block] = depth_epoch;
+}
+
+// Recompute the farthest depth of a dirty block of the hierarchical z-buffer
+float update_hiz_block(int block_x, int block_y) {
+  int x_start = block_x * HIZ_BLOCK_SIZE;
+  int y_start = block_y * HIZ_BLOCK_SIZE;
+  int x_end = x_start + HIZ_BLOCK_SIZE;
+  int y_end = y_start + HIZ_BLOCK_SIZE;
+  if (x_end > window_width) x_end = window_width;
+  if (y_end > window_height) y_end = window_height;
+
+  float max_depth = 0;
+  for (int y = y_start; y < y_end; y++) {
+    for (int x = x_start; x < x_end; x++) {
+      float depth = z_buffer[window_width * y + x];
+      max_depth = depth > max_depth ? depth : max_depth;
+    }
+  }
+
+  int block = hiz_width * block_y + block_x;
+  hiz_buffer[block] = max_depth;
+  hiz_dirty[block] = 0;
+  return max_depth;
+}
+
+// Save the color buffer as a binary PPM (P6) image
+bool save_color_buffer_ppm(char *filename) {
+  FILE *file = fopen(filename, "wb");
+  if (!file) {
+    fprintf(stderr, "Error opening %s for writing.\n", filename);
+    return false;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", window_width, window_height);
+
+  // Pixels are stored as RGBA32 (0xAABBGGRR), PPM only needs the RGB bytes
+  uint8_t *row = (uint8_t *)malloc(window_width * 3);
   for (int y = 0; y < window_height; y++) {
     for (int x = 0; x < window_width; x++) {
-      z_buffer[window_width * y + x] = 1.0;
+      uint32_t color = framebuffer.pixels[framebuffer.pitch * y + x];
+      row[x * 3 + 0] = color & 0xFF;
+      row[x * 3 + 1] = (color >> 8) & 0xFF;
+      row[x * 3 + 2] = (color >> 16) & 0xFF;
     }
+    fwrite(row, 3, window_width, file);
+  }
+  free(row);
+
+  return fclose(file) == 0;
+}
+
+// Count the pixels of the color buffer that differ from a PPM image saved by
+// save_color_buffer_ppm by more than tolerance in any channel. Return -1 if
+// the image can not be read or its size is not the size of the window.
+int compare_color_buffer_ppm(char *filename, int tolerance) {
+  FILE *file = fopen(filename, "rb");
+  if (!file) {
+    return -1;
+  }
+
+  int width, height, max_value;
+  if (fscanf(file, "P6 %d %d %d", &width, &height, &max_value) != 3 ||
+      width != window_width || height != window_height || max_value != 255 ||
+      fgetc(file) == EOF) {
+    fclose(file);
+    return -1;
   }
+
+  int num_different = 0;
+  uint8_t *row = (uint8_t *)malloc(window_width * 3);
+  for (int y = 0; y < window_height && num_different >= 0; y++) {
+    if (fread(row, 3, window_width, file) != (size_t)window_width) {
+      num_different = -1;
+      break;
+    }
+    for (int x = 0; x < window_width; x++) {
+      uint32_t color = framebuffer.pixels[framebuffer.pitch * y + x];
+      for (int channel = 0; channel < 3; channel++) {
+        int value = (color >> (8 * channel)) & 0xFF;
+        if (abs(value - row[x * 3 + channel]) > tolerance) {
+          num_different++;
+          break;
+        }
+      }
+    }
+  }
+  free(row);
+  fclose(file);
+
+  return num_different;
+}
+
+// Append the color buffer as one raw RGBA frame to an open stream, so a batch
+// of frames can be piped into other tools (e.g. ffmpeg -f rawvideo)
+bool write_color_buffer_raw(FILE *file) {
+  for (int y = 0; y < window_height; y++) {
+    uint32_t *row = framebuffer.pixels + framebuffer.pitch * y;
+    if (fwrite(row, sizeof(uint32_t), window_width, file) !=
+        (size_t)window_width) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void destroy_window(void) {
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
+  if (renderer) SDL_DestroyRenderer(renderer);
+  if (window) SDL_DestroyWindow(window);
   SDL_Quit();  // opposite to SDL_Init
 }
@@ -4,16 +4,24 @@
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define FPS 60
 // how many ms each frame will take
 #define FRAME_TARGET_TIME (1000 / FPS)
 
+// Inclusive rectangle of pixels that a drawing function is allowed to touch
+typedef struct {
+  int min_x, min_y, max_x, max_y;
+} rect_t;
+
 extern bool CULL_BACKFACE;
 extern bool RENDER_WIREFRAME;
 extern bool RENDER_FILL;
 extern bool RENDER_VERTICES;
 extern bool RENDER_TEXTURED;
+extern bool USE_VISIBILITY_BUFFER;
+extern bool LAZY_DEPTH_CLEAR;
 
 // extern means that this is external variable defined in the implementation
 // (display.c)
@@ -21,21 +29,62 @@ extern SDL_Window *window;
 extern SDL_Renderer *renderer;
 extern uint32_t *color_buffer;  // -> uint32_t means that element should be of
                                 // length 32bits (4 bytes)
+
+// Pixels the frame is drawn into. It is the color buffer, or the memory of the
+// locked streaming texture when the frame is presented without a copy, whose
+// rows may be padded.
+typedef struct {
+  uint32_t *pixels;
+  int pitch;  // number of pixels from the start of a row to the next one
+} framebuffer_t;
+
+extern framebuffer_t framebuffer;
+extern bool ZERO_COPY_PRESENT;
 extern float *z_buffer;
+extern uint32_t *visibility_buffer;  // triangle id + 1 per pixel, 0 if none
+
+// Hierarchical z-buffer with the farthest depth of every block of
+// HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE pixels of the z-buffer. Dirty blocks may
+// hold a stale (farther than real) depth that is recomputed when needed.
+// A block whose epoch is not depth_epoch has not been cleared this frame.
+#define HIZ_BLOCK_SIZE 8
+extern float *hiz_buffer;
+extern uint8_t *hiz_dirty;
+extern uint32_t *hiz_epoch;
+extern uint32_t depth_epoch;
+extern int hiz_width;
+extern int hiz_height;
 extern SDL_Texture *color_buffer_texture;
 extern int window_width;
 extern int window_height;
 
 // declarations for which implementations are in .c files
 bool initialize_window(void);
-void draw_grid();
+bool initialize_headless(int width, int height);
+void create_frame_buffers(void);
+void destroy_frame_buffers(void);
+void draw_grid(uint32_t color, int gap_size);
 void draw_pixel(int x, int y, uint32_t color);
 void draw_rect(int xCoord, int yCoord, int width, int height, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
+rect_t screen_rect(void);
+void draw_rect_clipped(int xCoord, int yCoord, int width, int height,
+                       uint32_t color, rect_t clip);
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color,
+                       rect_t clip);
 
+void lock_framebuffer(void);
 void render_color_buffer(void);
+void render_pixels(uint32_t *pixels);
+void fill_buffer(uint32_t *buffer, uint32_t value, size_t count);
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer(void);
+void reset_z_buffer(void);
+void prepare_hiz_block(int block_x, int block_y);
+float update_hiz_block(int block_x, int block_y);
+bool save_color_buffer_ppm(char *filename);
+int compare_color_buffer_ppm(char *filename, int tolerance);
+bool write_color_buffer_raw(FILE *file);
 void destroy_window(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+// mmap and friends are POSIX, not part of C99
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "file_map.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory-mapped files
+///////////////////////////////////////////////////////////////////////////////
+//
+// Mapping a file lets the loaders parse it in place, the pages are read from
+// disk on demand by the OS without copying them through a read buffer.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+
+bool map_file(file_map_t *map, char *filename) {
+  map->data = NULL;
+  map->size = 0;
+  map->handle = NULL;
+
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+  map->size = (size_t)size.QuadPart;
+  if (map->size == 0) {
+    CloseHandle(file);
+    return true;  // an empty file can not be mapped, but it is valid
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping) {
+    return false;
+  }
+
+  map->data = (char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!map->data) {
+    CloseHandle(mapping);
+    return false;
+  }
+  map->handle = mapping;
+  return true;
+}
+
+void unmap_file(file_map_t *map) {
+  if (map->data) {
+    UnmapViewOfFile(map->data);
+  }
+  if (map->handle) {
+    CloseHandle((HANDLE)map->handle);
+  }
+  map->data = NULL;
+  map->size = 0;
+  map->handle = NULL;
+}
+
+bool get_file_info(char *filename, uint64_t *size, int64_t *mtime) {
+  WIN32_FILE_ATTRIBUTE_DATA info;
+  if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info)) {
+    return false;
+  }
+  *size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+  *mtime = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) |
+                     info.ftLastWriteTime.dwLowDateTime);
+  return true;
+}
+
+#else
+
+bool map_file(file_map_t *map, char *filename) {
+  map->data = NULL;
+  map->size = 0;
+  map->handle = NULL;
+
+  int file = open(filename, O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(file, &info) != 0) {
+    close(file);
+    return false;
+  }
+  map->size = (size_t)info.st_size;
+  if (map->size == 0) {
+    close(file);
+    return true;  // an empty file can not be mapped, but it is valid
+  }
+
+  void *data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);  // the mapping keeps its own reference to the file
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  map->data = (char *)data;
+  return true;
+}
+
+void unmap_file(file_map_t *map) {
+  if (map->data) {
+    munmap(map->data, map->size);
+  }
+  map->data = NULL;
+  map->size = 0;
+  map->handle = NULL;
+}
+
+bool get_file_info(char *filename, uint64_t *size, int64_t *mtime) {
+  struct stat info;
+  if (stat(filename, &info) != 0) {
+    return false;
+  }
+  *size = (uint64_t)info.st_size;
+  *mtime = (int64_t)info.st_mtime;
+  return true;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only view of a whole file mapped into memory
+typedef struct {
+  char *data;    // first byte of the file, NULL if the file is empty
+  size_t size;   // size of the file in bytes
+  void *handle;  // platform mapping handle
+} file_map_t;
+
+bool map_file(file_map_t *map, char *filename);
+void unmap_file(file_map_t *map);
+
+// Get the size and the last modification time of a file
+bool get_file_info(char *filename, uint64_t *size, int64_t *mtime);
+
+#endif
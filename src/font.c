@@ -0,0 +1,88 @@
+#include "font.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include "display.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Bitmap font
+///////////////////////////////////////////////////////////////////////////////
+//
+// A 5x7 font with the digits, the upper case letters and some punctuation,
+// enough for on-screen statistics. Every glyph is 7 rows of 5 bits, the most
+// significant bit is the leftmost pixel. Lower case letters are drawn upper
+// case and missing characters are left blank.
+//
+///////////////////////////////////////////////////////////////////////////////
+uint8_t font_glyphs[128][FONT_HEIGHT] = {
+    ['0'] = {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+    ['1'] = {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    ['2'] = {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+    ['3'] = {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    ['4'] = {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+    ['5'] = {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    ['6'] = {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+    ['7'] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    ['8'] = {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+    ['9'] = {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+    ['A'] = {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    ['B'] = {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    ['C'] = {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},
+    ['D'] = {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    ['E'] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},
+    ['F'] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    ['G'] = {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},
+    ['H'] = {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    ['I'] = {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    ['J'] = {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    ['K'] = {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+    ['L'] = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    ['M'] = {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},
+    ['N'] = {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    ['O'] = {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    ['P'] = {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    ['Q'] = {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},
+    ['R'] = {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    ['S'] = {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},
+    ['T'] = {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    ['U'] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+    ['V'] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    ['W'] = {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},
+    ['X'] = {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    ['Y'] = {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04},
+    ['Z'] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+    ['.'] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+    [':'] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+    ['-'] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},
+    ['/'] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+    ['%'] = {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+    ['('] = {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},
+    [')'] = {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},
+};
+
+// Draw a line of text with its top left corner at x, y, every font pixel
+// drawn as a scale x scale square
+void draw_text(int x, int y, char *text, int scale, uint32_t color) {
+  for (; *text; text++, x += (FONT_WIDTH + 1) * scale) {
+    int c = toupper((unsigned char)*text);
+    if (c >= 128) continue;
+
+    for (int row = 0; row < FONT_HEIGHT; row++) {
+      uint8_t bits = font_glyphs[c][row];
+      for (int column = 0; column < FONT_WIDTH; column++) {
+        if (!(bits & (0x10 >> column))) continue;
+        for (int dy = 0; dy < scale; dy++) {
+          for (int dx = 0; dx < scale; dx++) {
+            draw_pixel(x + column * scale + dx, y + row * scale + dy, color);
+          }
+        }
+      }
+    }
+  }
+}
+
+int get_text_width(char *text, int scale) {
+  int length = (int)strlen(text);
+  return length > 0 ? ((FONT_WIDTH + 1) * length - 1) * scale : 0;
+}
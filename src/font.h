@@ -0,0 +1,13 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+
+// Size of a glyph of the built-in bitmap font in pixels, before scaling
+#define FONT_WIDTH 5
+#define FONT_HEIGHT 7
+
+void draw_text(int x, int y, char *text, int scale, uint32_t color);
+int get_text_width(char *text, int scale);
+
+#endif
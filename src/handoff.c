@@ -0,0 +1,58 @@
+#include "handoff.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Single-producer single-consumer handoff queue
+///////////////////////////////////////////////////////////////////////////////
+//
+// A ring buffer where only the producer moves the tail and only the consumer
+// moves the head, so pushing and popping need no lock. The SDL atomics are
+// full memory barriers: an item is written before the tail that publishes it,
+// and read before the head that frees its slot again. The semaphore counts
+// the items, it only lets an empty consumer sleep instead of spinning.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool create_handoff_queue(handoff_queue_t *queue) {
+  SDL_AtomicSet(&queue->head, 0);
+  SDL_AtomicSet(&queue->tail, 0);
+  queue->available = SDL_CreateSemaphore(0);
+  return queue->available != NULL;
+}
+
+void destroy_handoff_queue(handoff_queue_t *queue) {
+  if (queue->available) {
+    SDL_DestroySemaphore(queue->available);
+    queue->available = NULL;
+  }
+}
+
+// Called by the producer, return false if the queue is full
+bool push_handoff(handoff_queue_t *queue, int item) {
+  // The positions only ever grow and wrap around as unsigned ints
+  unsigned int tail = (unsigned int)SDL_AtomicGet(&queue->tail);
+  unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+  if (tail - head == HANDOFF_QUEUE_SIZE) {
+    return false;
+  }
+
+  queue->items[tail % HANDOFF_QUEUE_SIZE] = item;
+  SDL_AtomicSet(&queue->tail, (int)(tail + 1));
+  SDL_SemPost(queue->available);
+  return true;
+}
+
+// Called by the consumer, wait up to timeout_ms milliseconds for an item
+// (0 does not wait, -1 waits forever) and return false if there is none
+bool pop_handoff(handoff_queue_t *queue, int *item, int timeout_ms) {
+  int result = timeout_ms < 0    ? SDL_SemWait(queue->available)
+               : timeout_ms == 0 ? SDL_SemTryWait(queue->available)
+                                 : SDL_SemWaitTimeout(queue->available,
+                                                      timeout_ms);
+  if (result != 0) {
+    return false;
+  }
+
+  unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+  *item = queue->items[head % HANDOFF_QUEUE_SIZE];
+  SDL_AtomicSet(&queue->head, (int)(head + 1));
+  return true;
+}
@@ -0,0 +1,23 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+// Maximum number of items waiting in a queue, a power of two
+#define HANDOFF_QUEUE_SIZE 64
+
+// Queue of ints handed over from one producer thread to one consumer thread
+typedef struct {
+  int items[HANDOFF_QUEUE_SIZE];
+  SDL_atomic_t head;    // next item to pop, only written by the consumer
+  SDL_atomic_t tail;    // next slot to push to, only written by the producer
+  SDL_sem *available;  // number of items in the queue, to sleep on
+} handoff_queue_t;
+
+bool create_handoff_queue(handoff_queue_t *queue);
+void destroy_handoff_queue(handoff_queue_t *queue);
+bool push_handoff(handoff_queue_t *queue, int item);
+bool pop_handoff(handoff_queue_t *queue, int *item, int timeout_ms);
+
+#endif
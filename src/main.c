@@ -1,44 +1,187 @@
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "array.h"
 #include "camera.h"
 #include "display.h"
+#include "handoff.h"
 #include "light.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "profiler.h"
+#include "span.h"
+#include "stats.h"
 #include "texture.h"
+#include "tiles.h"
+#include "trace.h"
 #include "triangle.h"
 #include "upng.h"
 #include "vector.h"
+#include "vertex_cache.h"
 
-// pointer in the memory for the array of triangles that should be rendered
-#define MAX_TRIANGLES_PER_MESH 10000
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
+// Queue of the triangles that should be rendered this frame. It is a dynamic
+// array that is emptied every frame but keeps its capacity, so once it has
+// grown to the size of the scene no more allocations are made.
+triangle_t *triangles_to_render = NULL;
 int num_triangles_to_render = 0;
 
+// Second queue that the geometry stage fills with the triangles of the next
+// frame, swapped with the one above between frames
+triangle_t *triangles_next_frame = NULL;
+int num_triangles_next_frame = 0;
+
 // vec3_t camera_position = {.x = 0, .y = 0, .z = 0};  // NO NEEDED ANYMORE DUE
 // TO INTRODUCING CAMERA
 
 mat4_t proj_matrix;
 mat4_t view_matrix;
 mat4_t world_matrix;
+mat4_t model_view_matrix;
+
+// Mesh transform and camera that the model-view matrix was built from. The
+// matrix is only rebuilt when one of them changes.
+typedef struct {
+  vec3_t rotation;
+  vec3_t scale;
+  vec3_t translation;
+  vec3_t camera_position;
+  float camera_yaw;
+} transform_state_t;
+
+transform_state_t model_view_state;
+bool model_view_dirty = true;
+
+// Snapshot of everything the geometry stage reads that can change between
+// frames. It is taken by update(), so the stage can run on another thread
+// while the input and the animation change the live state.
+typedef struct {
+  transform_state_t transform;
+  bool cull_backface;
+} frame_state_t;
+
+// Post-transform vertex buffers with every vertex of the mesh in camera space
+// and projected to the screen, filled once per frame and indexed by the faces
+vec4_soa_t camera_vertices;
+vec4_soa_t screen_vertices;
 
 bool is_running = false;
 int previous_frame_time = 0;
 float delta_time = 0;
 
+// Headless mode renders offscreen into the color buffer and writes the frames
+// to disk instead of presenting them in an SDL window
+bool is_headless = false;
+int headless_width = 800;
+int headless_height = 600;
+int headless_frames = 100;
+char *output_filename = NULL;
+
+// Number of threads of the tiled rasterizer, 0 draws serially on this thread
+// and -1 picks one thread per CPU core
+int raster_threads = -1;
+
+// Transform the geometry of the next frame on a separate thread while the
+// current frame is rasterized
+bool pipeline_geometry = false;
+
+// Number of color buffers that frames are drawn into on a separate thread
+// while the main thread presents them, 0 draws and presents on the main thread
+#define MAX_PRESENT_BUFFERS 3
+int num_present_buffers = 0;
+uint32_t *present_buffers[MAX_PRESENT_BUFFERS];
+uint64_t present_buffer_ticks[MAX_PRESENT_BUFFERS][PROFILE_NUM_STAGES];
+
+handoff_queue_t free_buffers;
+handoff_queue_t ready_buffers;
+handoff_queue_t key_presses;
+SDL_atomic_t frame_thread_quit;
+
+// Name of the span and vertex transform kernels to use, NULL picks the fastest
+// the CPU supports
+char *span_kernel = NULL;
+
+// Load the mesh from the binary cache next to the OBJ file, and write the
+// cache when it is missing or out of date
+bool use_mesh_cache = true;
+
+// Reorder the faces and vertices of the mesh for the vertex cache after
+// loading it
+bool optimize_mesh = false;
+
+// CSV file the per-stage frame times are written to, NULL writes none
+char *profile_filename = NULL;
+
+// Chrome trace file the timeline of the run is written to on exit, NULL
+// traces nothing
+char *trace_filename = NULL;
+
+// Benchmark mode plays a scripted turntable over every model, offscreen and
+// with a fixed time step, and checks the last frame against a golden image
+bool is_benchmark = false;
+bool update_golden_images = false;
+float golden_tolerance = 0.1;  // percentage of pixels allowed to differ
+char *golden_directory = "./bench/golden";
+char *benchmark_models[] = {"crab", "cube", "drone", "efa",
+                            "f117", "f22",  "sphere"};
+#define NUM_BENCHMARK_MODELS \
+  (int)(sizeof(benchmark_models) / sizeof(benchmark_models[0]))
+
+// Difference in a color channel that still counts as the same pixel
+#define GOLDEN_CHANNEL_TOLERANCE 8
+
+char obj_filename[256] = "./assets/crab.obj";
+char png_filename[256] = "./assets/crab.png";
+
+// Load the mesh and the texture of obj_filename and png_filename, replacing
+// the ones loaded before
+void load_model(void) {
+  trace_begin("load_model");
+  free_mesh();
+  if (png_texture) {
+    upng_free(png_texture);
+  }
+  png_texture = NULL;
+  mesh_texture = NULL;
+
+  // Loads the cube values in the mesh data structure
+  // load_cube_mesh_data();
+  trace_begin("load_mesh");
+  float acmr[2] = {0, 0};  // before and after the vertex cache optimization
+  if (!use_mesh_cache || !load_mesh_cache(obj_filename, optimize_mesh, acmr)) {
+    load_obj_file_data(obj_filename);
+    if (optimize_mesh) {
+      acmr[0] = get_mesh_acmr();
+      optimize_vertex_cache();
+      acmr[1] = get_mesh_acmr();
+    }
+    if (use_mesh_cache) {
+      save_mesh_cache(obj_filename, optimize_mesh, acmr);
+    }
+  }
+  if (optimize_mesh) {
+    printf("Vertex cache ACMR: %.3f before, %.3f after reordering\n", acmr[0],
+           acmr[1]);
+  }
+  trace_end();
+
+  // Load the texture information from an external PNG file
+  trace_begin("load_png_texture_data");
+  load_png_texture_data(png_filename);
+  trace_end();
+  trace_end();
+}
+
 void setup(void) {
-  // allocate the required memory in bytes to hold the color buffer
-  color_buffer =
-      (uint32_t *)malloc(sizeof(uint32_t) * window_width * window_height);
-  z_buffer = (float *)malloc(
-      sizeof(float) * window_width *
-      window_height);  // (float *) -> means casting to float value
+  trace_begin("setup");
+  create_frame_buffers();
 
   // creating an SDL texture that is used to display the color buffer
-  color_buffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                                           SDL_TEXTUREACCESS_STREAMING,
-                                           window_width, window_height);
+  if (!is_headless) {
+    color_buffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                                             SDL_TEXTUREACCESS_STREAMING,
+                                             window_width, window_height);
+  }
 
   // Initialize the perspective projection matrix
   float fov = M_PI / 3.0;  // 60deg in radians -> 60 * PI/180
@@ -47,12 +190,21 @@ void setup(void) {
   float zfar = 100;
   proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
 
-  // Loads the cube values in the mesh data structure
-  // load_cube_mesh_data();
-  load_obj_file_data("./assets/crab.obj");
+  load_model();
 
-  // Load the texture information from an external PNG file
-  load_png_texture_data("./assets/crab.png");
+  // Start with a cleared depth buffer, malloc leaves it uninitialized
+  clear_z_buffer();
+
+  initialize_span_kernels(span_kernel);
+  initialize_matrix_kernels(span_kernel);
+
+  if (raster_threads < 0) {
+    raster_threads = SDL_GetCPUCount();
+  }
+  if (raster_threads > 0 && !initialize_tiles(raster_threads)) {
+    raster_threads = 0;  // fall back to the serial rasterizer
+  }
+  trace_end();
 }
 
 void handle_key_press(SDL_Keycode keycode) {
@@ -75,6 +227,12 @@ void handle_key_press(SDL_Keycode keycode) {
     case SDLK_5:
       RENDER_TEXTURED = !RENDER_TEXTURED;
       break;
+    case SDLK_6:
+      USE_VISIBILITY_BUFFER = !USE_VISIBILITY_BUFFER;
+      break;
+    case SDLK_7:
+      SHOW_PROFILE_HUD = !SHOW_PROFILE_HUD;
+      break;
     case SDLK_UP:
       camera.position.y += 3.0 * delta_time;
       break;
@@ -100,6 +258,7 @@ void handle_key_press(SDL_Keycode keycode) {
 }
 
 void process_input(void) {
+  trace_begin("process_input");
   SDL_Event event;
   SDL_PollEvent(&event);  // & - means a reference to the event
 
@@ -108,9 +267,16 @@ void process_input(void) {
       is_running = false;
       break;
     case SDL_KEYDOWN:
-      handle_key_press(event.key.keysym.sym);
+      // The frame thread of --async-present owns the scene, only quitting
+      // is handled here
+      if (num_present_buffers > 0 && event.key.keysym.sym != SDLK_ESCAPE) {
+        push_handoff(&key_presses, event.key.keysym.sym);
+      } else {
+        handle_key_press(event.key.keysym.sym);
+      }
       break;
   }
+  trace_end();
 }
 
 // Function that receives 3D vector and return a projected 2D point
@@ -138,114 +304,115 @@ void process_input(void) {
 //   return projected_point;
 // }
 
-void update(void) {
-  // lock the update execution unless we hit frame target time since last frame
-  // DO NOT USE WHILE LOOPS FOR THAT - IT BLOCKS 100% CPU USAGE
-  // while (!SDL_TICKS_PASSED(SDL_GetTicks(),
-  //                          previous_frame_time + FRAME_TARGET_TIME))
-  //   ;
+// Direction the camera looks at for a yaw angle
+vec3_t get_camera_direction(float yaw) {
+  // Initialize the target looking at the positive z-axis
+  vec3_t target = {0, 0, 1};
+  mat4_t camera_yaw_rotation = mat4_make_rotation_y(yaw);
+  return vec3_from_vec4(
+      mat4_mul_vec4(camera_yaw_rotation, vec4_from_vec3(target)));
+}
 
-  // do the SDL_Delay instead
+// Build the view matrix and the world matrix of the mesh, and combine them in
+// the model-view matrix that takes the mesh vertices to camera space
+void update_model_view_matrix(transform_state_t *state) {
+  if (!model_view_dirty &&
+      memcmp(state, &model_view_state, sizeof(*state)) == 0) {
+    return;
+  }
+  model_view_state = *state;
+  model_view_dirty = false;
 
-  int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
+  // Offset the camera position in the direction where the camera is pointing at
+  vec3_t direction = get_camera_direction(state->camera_yaw);
+  vec3_t target = vec3_add(state->camera_position, direction);
+  vec3_t up_direction = {0, 1, 0};
 
-  if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-    SDL_Delay(time_to_wait);
-  }
+  // Create the view matrix
+  view_matrix = mat4_look_at(state->camera_position, target, up_direction);
 
-  // Get a delta time factor converted to seconds to be used to update our game
-  // objects
-  delta_time = (SDL_GetTicks() - previous_frame_time) / 1000.0;
+  // Create matrices that will be used to multiply mesh vertices
+  vec3_t scale = state->scale;
+  vec3_t translation = state->translation;
+  mat4_t scale_matrix = mat4_make_scale(scale.x, scale.y, scale.z);
+  mat4_t translation_matrix =
+      mat4_make_translation(translation.x, translation.y, translation.z);
+  mat4_t rotation_matrix_x = mat4_make_rotation_x(state->rotation.x);
+  mat4_t rotation_matrix_y = mat4_make_rotation_y(state->rotation.y);
+  mat4_t rotation_matrix_z = mat4_make_rotation_z(state->rotation.z);
+
+  // Create a World Matrix combining scale, rotation and translation matrices
+  world_matrix = mat4_identity();
+  // Multiply all matrices and load the world matrix
+  // Order matters. First scale, then rotate, and then translate.
+  world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+  world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+  world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+  world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+  world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+
+  // Multiply the view matrix by the world matrix, so every vertex only needs
+  // one matrix multiplication to get to camera space
+  model_view_matrix = mat4_mul_mat4(view_matrix, world_matrix);
+}
 
-  previous_frame_time = SDL_GetTicks();
+// Geometry stage: transform, cull and project the mesh as it was in the
+// snapshot, and fill the queue of the next frame with its triangles. Returns
+// the number of back faces culled.
+int transform_geometry(frame_state_t *state) {
+  trace_begin("geometry");
 
   // initialize the array of triangles to render
   // reset on every loop
   // triangles_to_render = NULL;
 
-  // initialize the counter of triangles to render for the current frame
-  num_triangles_to_render = 0;
+  // empty the queue of triangles to render for the next frame
+  array_reset(triangles_next_frame);
+  num_triangles_next_frame = 0;
 
-  // Change the mesh scale/rotation/translation values per animation frame
-  // mesh.rotation.x += 0.02;
-  mesh.rotation.y += 0.2 * delta_time;
-  // mesh.rotation.z += 0.02;
-  // mesh.scale.x -= 0.002;
-  // mesh.scale.y -= 0.002;
-  // mesh.scale.z -= 0.002;
-  // mesh.translation.x += 0.01;
-  // Translate the vertices away from the camera in z direction
-  mesh.translation.z = 5.0;
-  // mesh.translation.y += 0.005;
+  update_model_view_matrix(&state->transform);
 
-  // Change the camera position per animation frame
-  // camera.position.x += 0.8 * delta_time;
-  // camera.position.y += 0.8 * delta_time;
+  // Transform and project every vertex of the mesh once. A vertex is shared by
+  // about six faces of a closed mesh, which only look it up by index below.
+  int num_vertices = array_length(mesh.vertices);
+  if (!vec4_soa_reserve(&camera_vertices, num_vertices) ||
+      !vec4_soa_reserve(&screen_vertices, num_vertices)) {
+    fprintf(stderr, "Error allocating the post-transform vertices.\n");
+    trace_end();
+    return 0;
+  }
 
-  // Initialize the target looking at the positive z-axis
-  vec3_t target = {0, 0, 1};
-  mat4_t camera_yaw_rotation = mat4_make_rotation_y(camera.yaw);
-  camera.direction = vec3_from_vec4(
-      mat4_mul_vec4(camera_yaw_rotation, vec4_from_vec3(target)));
+  // Multiply the model-view matrix by all the vertices to transform them to
+  // camera space, and then project them
+  mat4_mul_vec4_batch(model_view_matrix, &mesh.vertex_stream, &camera_vertices,
+                      num_vertices, false);
+  mat4_mul_vec4_batch(proj_matrix, &camera_vertices, &screen_vertices,
+                      num_vertices, true);
 
-  // Offset the camera position in the direction where the camera is pointing at
-  target = vec3_add(camera.position, camera.direction);
-  vec3_t up_direction = {0, 1, 0};
+  for (int i = 0; i < num_vertices; i++) {
+    // scale into the view
+    screen_vertices.x[i] *= (window_width / 2.0);
+    screen_vertices.y[i] *= (window_height / 2.0);
 
-  // Create the view matrix
-  view_matrix = mat4_look_at(camera.position, target, up_direction);
+    // Invert the y values to account for flipped screen y coordinate
+    screen_vertices.y[i] *= -1;
 
-  // Create matrices that will be used to multiply mesh vertices
-  mat4_t scale_matrix =
-      mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-  mat4_t translation_matrix = mat4_make_translation(
-      mesh.translation.x, mesh.translation.y, mesh.translation.z);
-  mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-  mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-  mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
+    // translate the projected points to the middle of the screen
+    screen_vertices.x[i] += (window_width / 2.0);
+    screen_vertices.y[i] += (window_height / 2.0);
+  }
 
   int num_faces = array_length(mesh.faces);
+  int num_faces_culled = 0;
 
   // Loop all triangle faces of our mesh
   for (int i = 0; i < num_faces; i++) {
     face_t mesh_face = mesh.faces[i];
-
-    vec3_t face_vertices[3];
-    face_vertices[0] = mesh.vertices[mesh_face.a];
-    face_vertices[1] = mesh.vertices[mesh_face.b];
-    face_vertices[2] = mesh.vertices[mesh_face.c];
+    int face_indices[3] = {mesh_face.a, mesh_face.b, mesh_face.c};
 
     vec4_t transformed_vertices[3];
-
-    // Loop all three vertices of this current face and apply transformations
     for (int j = 0; j < 3; j++) {
-      vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-      // Create a World Matrix combining scale, rotation and translation
-      // matrices
-      world_matrix = mat4_identity();
-      // Multiply all matrices and load the world matrix
-      // Order matters. First scale, then rotate, and then translate.
-      world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-      world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-      world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-      // Multiply the world matrix by the original vector
-      transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-
-      // Multiply the view matrix by the vector to transform the scene to camera
-      // space
-      transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
-
-      // transformed_vertex = vec3_rotate_x(transformed_vertex,
-      // mesh.rotation.x); transformed_vertex =
-      // vec3_rotate_y(transformed_vertex, mesh.rotation.y); transformed_vertex
-      // = vec3_rotate_z(transformed_vertex, mesh.rotation.z);
-
-      // save transformed vertex in the array of transformed vertices;
-      transformed_vertices[j] = transformed_vertex;
+      transformed_vertices[j] = vec4_soa_get(&camera_vertices, face_indices[j]);
     }
 
     // Backface culling check
@@ -276,31 +443,17 @@ void update(void) {
     // product)
     float dot_normal_camera = vec3_dot(camera_ray, normal);
 
-    if (CULL_BACKFACE) {
+    if (state->cull_backface) {
       // bypass the triangles that are looking away from the camera
       if (dot_normal_camera < 0) {
+        num_faces_culled++;
         continue;
       }
     }
 
     vec4_t projected_points[3];
-
-    // loop all three vertices to perform projection
     for (int j = 0; j < 3; j++) {
-      // Project the current vertex
-      projected_points[j] =
-          mat4_mul_vec4_project(proj_matrix, transformed_vertices[j]);
-
-      // scale into the view
-      projected_points[j].x *= (window_width / 2.0);
-      projected_points[j].y *= (window_height / 2.0);
-
-      // Invert the y values to account for flipped screen y coordinate
-      projected_points[j].y *= -1;
-
-      // translate the projected points to the middle of the screen
-      projected_points[j].x += (window_width / 2.0);
-      projected_points[j].y += (window_height / 2.0);
+      projected_points[j] = vec4_soa_get(&screen_vertices, face_indices[j]);
     }
 
     // removed with implementing z-buffer
@@ -322,29 +475,26 @@ void update(void) {
         .points =
             {
                 {projected_points[0].x, projected_points[0].y,
-                 projected_points[0].z, projected_points[0].w},
+                 projected_points[0].w},
                 {projected_points[1].x, projected_points[1].y,
-                 projected_points[1].z, projected_points[1].w},
+                 projected_points[1].w},
                 {projected_points[2].x, projected_points[2].y,
-                 projected_points[2].z, projected_points[2].w},
+                 projected_points[2].w},
             },
         .texcoords =
             {
-                {mesh_face.a_uv.u, mesh_face.a_uv.v},
-                {mesh_face.b_uv.u, mesh_face.b_uv.v},
-                {mesh_face.c_uv.u, mesh_face.c_uv.v},
+                mesh.texcoords[mesh_face.a],
+                mesh.texcoords[mesh_face.b],
+                mesh.texcoords[mesh_face.c],
             },
         .color = triangle_color};
     // .avg_depth = avg_depth};
 
     // Save the projected triangle in the array of triangles to render
-    // triangles_to_render[i] = projected_triangle;
-    if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-      triangles_to_render[num_triangles_to_render] = projected_triangle;
-      num_triangles_to_render++;
-    }
-    // array_push(triangles_to_render, projected_triangle);
+    array_push(triangles_next_frame, projected_triangle);
   }
+  num_triangles_next_frame = array_length(triangles_next_frame);
+  trace_end();
 
   // Sort triangles by their average z-depth value
   // int num_triangles = array_length(triangles_to_render);
@@ -359,102 +509,765 @@ void update(void) {
   //     }
   //   }
   // }
+
+  return num_faces_culled;
 }
 
-void render(void) {
+///////////////////////////////////////////////////////////////////////////////
+// Pipelined geometry
+///////////////////////////////////////////////////////////////////////////////
+//
+// With --pipeline a geometry thread runs transform_geometry() for frame N+1
+// while the raster stage draws frame N, so a frame takes about the longest of
+// the two stages instead of their sum, at the cost of a frame of latency.
+// update() is the only point where the stages meet: it waits for the geometry
+// in flight, swaps the two triangle queues and starts the next geometry from
+// a new snapshot of the state. The geometry thread only reads the snapshot
+// and writes its own buffers; the render flags other than culling are only
+// read by the raster stage, on the thread that handles the key presses.
+//
+///////////////////////////////////////////////////////////////////////////////
+SDL_Thread *geometry_thread = NULL;
+SDL_sem *geometry_start = NULL;
+SDL_sem *geometry_done = NULL;
+bool geometry_quit = false;
+
+// Input and results of the geometry in flight, there is none before the
+// first frame
+bool geometry_in_flight = false;
+frame_state_t geometry_state;
+int geometry_faces_culled = 0;
+uint64_t geometry_ticks = 0;
+
+int geometry_worker(void *data) {
+  set_trace_thread_name("geometry");
+  while (true) {
+    SDL_SemWait(geometry_start);
+    if (geometry_quit) {
+      break;
+    }
+    uint64_t start = SDL_GetPerformanceCounter();
+    geometry_faces_culled = transform_geometry(&geometry_state);
+    geometry_ticks = SDL_GetPerformanceCounter() - start;
+    SDL_SemPost(geometry_done);
+  }
+  return 0;
+}
+
+void destroy_geometry_thread(void) {
+  if (geometry_thread) {
+    SDL_SemWait(geometry_done);  // let the geometry in flight finish
+    geometry_quit = true;
+    SDL_SemPost(geometry_start);
+    SDL_WaitThread(geometry_thread, NULL);
+    geometry_thread = NULL;
+    geometry_in_flight = false;
+  }
+  if (geometry_start) SDL_DestroySemaphore(geometry_start);
+  if (geometry_done) SDL_DestroySemaphore(geometry_done);
+  geometry_start = NULL;
+  geometry_done = NULL;
+}
+
+// Start the geometry thread when --pipeline asks for it, without it (or if it
+// can not be created) update() transforms the geometry itself
+void initialize_geometry_thread(void) {
+  if (!pipeline_geometry) {
+    return;
+  }
+  geometry_quit = false;
+  geometry_start = SDL_CreateSemaphore(0);
+  // Nothing is in flight before the first frame, which then draws nothing
+  geometry_done = SDL_CreateSemaphore(1);
+  if (geometry_start && geometry_done) {
+    geometry_thread = SDL_CreateThread(geometry_worker, "geometry", NULL);
+  }
+  if (!geometry_thread) {
+    fprintf(stderr, "Error creating the geometry thread.\n");
+    destroy_geometry_thread();
+  }
+}
+
+// Make the triangles of the next frame the ones to render
+void swap_triangle_queues(void) {
+  triangle_t *triangles = triangles_to_render;
+  triangles_to_render = triangles_next_frame;
+  num_triangles_to_render = num_triangles_next_frame;
+  triangles_next_frame = triangles;
+  num_triangles_next_frame = 0;
+}
+
+void count_geometry_stats(int num_faces_culled) {
+  count_pipeline_stat(STAT_FACES_PROCESSED, array_length(mesh.faces));
+  count_pipeline_stat(STAT_FACES_CULLED, num_faces_culled);
+  count_pipeline_stat(STAT_TRIANGLES_EMITTED, num_triangles_to_render);
+}
+
+void update(void) {
+  trace_begin("update");
+
+  // lock the update execution unless we hit frame target time since last frame
+  // DO NOT USE WHILE LOOPS FOR THAT - IT BLOCKS 100% CPU USAGE
+  // while (!SDL_TICKS_PASSED(SDL_GetTicks(),
+  //                          previous_frame_time + FRAME_TARGET_TIME))
+  //   ;
+
+  // do the SDL_Delay instead
+
+  if (is_headless) {
+    // Run as fast as possible with a fixed time step, so every headless run
+    // animates the exact same frames regardless of how long they take
+    delta_time = FRAME_TARGET_TIME / 1000.0;
+  } else {
+    int time_to_wait =
+        FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
+
+    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
+      SDL_Delay(time_to_wait);
+    }
+
+    // Get a delta time factor converted to seconds to be used to update our
+    // game objects
+    delta_time = (SDL_GetTicks() - previous_frame_time) / 1000.0;
+
+    previous_frame_time = SDL_GetTicks();
+  }
+
+  // Change the mesh scale/rotation/translation values per animation frame
+  // mesh.rotation.x += 0.02;
+  if (!is_benchmark) {
+    mesh.rotation.y += 0.2 * delta_time;  // the benchmark script rotates it
+  }
+  // mesh.rotation.z += 0.02;
+  // mesh.scale.x -= 0.002;
+  // mesh.scale.y -= 0.002;
+  // mesh.scale.z -= 0.002;
+  // mesh.translation.x += 0.01;
+  // Translate the vertices away from the camera in z direction
+  mesh.translation.z = 5.0;
+  // mesh.translation.y += 0.005;
+
+  // Change the camera position per animation frame
+  // camera.position.x += 0.8 * delta_time;
+  // camera.position.y += 0.8 * delta_time;
+
+  // Keep the direction of the live camera up to date for the key presses, the
+  // geometry stage only reads the snapshot
+  camera.direction = get_camera_direction(camera.yaw);
+
+  frame_state_t state = {{mesh.rotation, mesh.scale, mesh.translation,
+                          camera.position, camera.yaw},
+                         CULL_BACKFACE};
+
+  if (geometry_thread) {
+    // Draw the geometry finished in the background and start the next one
+    SDL_SemWait(geometry_done);
+    swap_triangle_queues();
+    if (geometry_in_flight) {
+      profile_add(PROFILE_GEOMETRY, geometry_ticks);
+      count_geometry_stats(geometry_faces_culled);
+    }
+    geometry_state = state;
+    geometry_in_flight = true;
+    SDL_SemPost(geometry_start);
+  } else {
+    profile_begin(PROFILE_GEOMETRY);
+    int num_faces_culled = transform_geometry(&state);
+    profile_end(PROFILE_GEOMETRY);
+    swap_triangle_queues();
+    count_geometry_stats(num_faces_culled);
+  }
+
+  trace_end();
+}
+
+// Draw the frame into the framebuffer: the background, the triangles and the
+// HUD. The z-buffer is left ready for the next frame.
+void draw_frame(void) {
   // removed because we render color and clear buffer by hand later
   // SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
   // SDL_RenderClear(renderer);
 
+  profile_begin(PROFILE_CLEAR);
   clear_color_buffer(0xFF151515);
 
-  draw_grid();
+  draw_grid(0xFF333333, 10);
   // draw_rect(200, 200, 500, 200, 0xFF0000FF);
   // draw_pixel(20, 20, 0XFFFFFF00);
-
-  // Loop all projected triangles and render them
-  // int num_triangles = array_length(triangles_to_render);
-  for (int i = 0; i < num_triangles_to_render; i++) {
-    triangle_t triangle = triangles_to_render[i];
-
-    if (RENDER_VERTICES) {
-      float vw = 8.0;  // vertex width
-      // Draw vertex points
-      draw_rect(triangle.points[0].x - vw / 2, triangle.points[0].y - vw / 2,
-                vw, vw, 0xFFFFFF00);
-      draw_rect(triangle.points[1].x - vw / 2, triangle.points[1].y - vw / 2,
-                vw, vw, 0xFFFFFF00);
-      draw_rect(triangle.points[2].x - vw / 2, triangle.points[2].y - vw / 2,
-                vw, vw, 0xFFFFFF00);
+  profile_end(PROFILE_CLEAR);
+
+  profile_begin(PROFILE_RASTER);
+
+  count_rasterized_triangles(triangles_to_render, num_triangles_to_render);
+  if (raster_threads > 0) {
+    // Bin the projected triangles into screen tiles rasterized in parallel
+    render_tiles(triangles_to_render, num_triangles_to_render);
+  } else if (USE_VISIBILITY_BUFFER) {
+    // Rasterize the ids of all the triangles and then shade every pixel once
+    render_triangles_visibility(triangles_to_render, NULL,
+                                num_triangles_to_render, screen_rect());
+  } else {
+    // Loop all projected triangles and render them
+    for (int i = 0; i < num_triangles_to_render; i++) {
+      render_triangle(&triangles_to_render[i], screen_rect());
     }
+  }
+
+  profile_end(PROFILE_RASTER);
 
-    if (RENDER_FILL) {
-      // Draw filled triangle
-      draw_filled_triangle(
-          triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
-          triangle.points[0].w,  // vertex A
-          triangle.points[1].x, triangle.points[1].y, triangle.points[1].z,
-          triangle.points[1].w,  // vertex B
-          triangle.points[2].x, triangle.points[2].y, triangle.points[2].z,
-          triangle.points[2].w,  // vertex C
-          triangle.color);
+  // clear the array of triangles to render every frame loop
+  // array_free(triangles_to_render);
+
+  if (SHOW_PROFILE_HUD) {
+    draw_profile_hud();
+  }
+
+  profile_begin(PROFILE_CLEAR);
+  reset_z_buffer();
+  profile_end(PROFILE_CLEAR);
+}
+
+void render(void) {
+  trace_begin("render");
+
+  // Draw straight into the texture that is presented, if it can be locked
+  if (!is_headless) {
+    lock_framebuffer();
+  }
+
+  draw_frame();
+
+  if (!is_headless) {
+    profile_begin(PROFILE_UPLOAD);
+    trace_begin("render_color_buffer");
+    render_color_buffer();
+    trace_end();
+    profile_end(PROFILE_UPLOAD);
+
+    profile_begin(PROFILE_PRESENT);
+    trace_begin("SDL_RenderPresent");
+    SDL_RenderPresent(renderer);
+    trace_end();
+    profile_end(PROFILE_PRESENT);
+  }
+  trace_end();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous presentation
+///////////////////////////////////////////////////////////////////////////////
+//
+// SDL only allows rendering and event handling on the main thread, so with
+// --async-present the main thread keeps them and a frame thread runs update()
+// and draws the frames. It draws into one of num_present_buffers color
+// buffers while the main thread uploads and presents another one, so drawing
+// frame N+1 overlaps presenting frame N. The buffers go around through two
+// lock-free handoff queues: free ones to the frame thread and finished ones
+// back to the main thread. The z-buffer is only used while drawing a frame,
+// so a single one is enough.
+//
+// Key presses are handed over to the frame thread as well, so all the state
+// of the scene is only changed by the thread that draws it. The main thread
+// times its stages per buffer, and the frame thread adds them to the profile
+// when it gets the buffer back.
+//
+///////////////////////////////////////////////////////////////////////////////
+int frame_thread(void *data) {
+  set_trace_thread_name("frame");
+
+  while (!SDL_AtomicGet(&frame_thread_quit)) {
+    int buffer;
+    if (!pop_handoff(&free_buffers, &buffer, 100)) {
+      continue;
+    }
+    for (int i = 0; i < PROFILE_NUM_STAGES; i++) {
+      profile_add(i, present_buffer_ticks[buffer][i]);
     }
 
-    if (RENDER_TEXTURED) {
-      // Draw textured triangle
-      draw_textured_triangle(
-          triangle.points[0].x, triangle.points[0].y, triangle.points[0].z,
-          triangle.points[0].w, triangle.texcoords[0].u,
-          triangle.texcoords[0].v,  // vertex A
-          triangle.points[1].x, triangle.points[1].y, triangle.points[1].z,
-          triangle.points[1].w, triangle.texcoords[1].u,
-          triangle.texcoords[1].v,  // vertex B
-          triangle.points[2].x, triangle.points[2].y, triangle.points[2].z,
-          triangle.points[2].w, triangle.texcoords[2].u,
-          triangle.texcoords[2].v,  // vertex C
-          mesh_texture);
+    int keycode;
+    while (pop_handoff(&key_presses, &keycode, 0)) {
+      handle_key_press(keycode);
     }
 
-    if (RENDER_WIREFRAME) {
-      // Draw unfilled triangle
-      draw_triangle(triangle.points[0].x, triangle.points[0].y,
-                    triangle.points[1].x, triangle.points[1].y,
-                    triangle.points[2].x, triangle.points[2].y, 0xFF000000);
+    trace_begin("frame");
+    framebuffer.pixels = present_buffers[buffer];
+    framebuffer.pitch = window_width;
+    update();
+    trace_begin("render");
+    draw_frame();
+    trace_end();
+    profile_end_frame();
+    end_pipeline_stats_frame();
+    trace_end();
+
+    push_handoff(&ready_buffers, buffer);
+  }
+  return 0;
+}
+
+bool create_present_buffers(void) {
+  if (!create_handoff_queue(&free_buffers) ||
+      !create_handoff_queue(&ready_buffers) ||
+      !create_handoff_queue(&key_presses)) {
+    return false;
+  }
+
+  for (int i = 0; i < num_present_buffers; i++) {
+    present_buffers[i] =
+        (uint32_t *)malloc(sizeof(uint32_t) * window_width * window_height);
+    if (!present_buffers[i]) {
+      return false;
     }
+    push_handoff(&free_buffers, i);
   }
+  return true;
+}
 
-  // clear the array of triangles to render every frame loop
-  // array_free(triangles_to_render);
+void destroy_present_buffers(void) {
+  for (int i = 0; i < num_present_buffers; i++) {
+    free(present_buffers[i]);
+    present_buffers[i] = NULL;
+  }
+  destroy_handoff_queue(&free_buffers);
+  destroy_handoff_queue(&ready_buffers);
+  destroy_handoff_queue(&key_presses);
+}
 
-  render_color_buffer();
-  clear_color_buffer(0xFF000000);
-  clear_z_buffer();
-  SDL_RenderPresent(renderer);
+void run_async_present(void) {
+  SDL_Thread *thread = NULL;
+  if (create_present_buffers()) {
+    SDL_AtomicSet(&frame_thread_quit, 0);
+    thread = SDL_CreateThread(frame_thread, "frame", NULL);
+  }
+  if (!thread) {
+    fprintf(stderr, "Error creating the frame thread, presenting in sync.\n");
+    destroy_present_buffers();
+    num_present_buffers = 0;
+    return;
+  }
+
+  uint64_t input_ticks = 0;
+  while (is_running) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    process_input();
+    input_ticks += SDL_GetPerformanceCounter() - start;
+
+    // Keep handling events while the frame thread draws
+    int buffer;
+    if (!pop_handoff(&ready_buffers, &buffer, 1)) {
+      continue;
+    }
+
+    uint64_t *ticks = present_buffer_ticks[buffer];
+    ticks[PROFILE_INPUT] = input_ticks;
+    input_ticks = 0;
+
+    start = SDL_GetPerformanceCounter();
+    trace_begin("render_color_buffer");
+    render_pixels(present_buffers[buffer]);
+    trace_end();
+    uint64_t uploaded = SDL_GetPerformanceCounter();
+    ticks[PROFILE_UPLOAD] = uploaded - start;
+
+    trace_begin("SDL_RenderPresent");
+    SDL_RenderPresent(renderer);
+    trace_end();
+    ticks[PROFILE_PRESENT] = SDL_GetPerformanceCounter() - uploaded;
+
+    push_handoff(&free_buffers, buffer);
+  }
+
+  SDL_AtomicSet(&frame_thread_quit, 1);
+  SDL_WaitThread(thread, NULL);
+  destroy_present_buffers();
 }
 
 // Free the memory that was dynamically allocated by the program
 void free_resources(void) {
-  free(color_buffer);  // free memory, free is opposite of malloc
-  free(z_buffer);
+  destroy_geometry_thread();
+  destroy_tiles();
+  destroy_frame_buffers();
   upng_free(png_texture);
-  array_free(mesh.faces);
-  array_free(mesh.vertices);
+  free_mesh();
+  vec4_soa_free(&camera_vertices);
+  vec4_soa_free(&screen_vertices);
+  array_free(triangles_to_render);
+  array_free(triangles_next_frame);
 }
 
-int main(int argc, char *argv[]) {
-  is_running = initialize_window();
+void print_usage(char *program) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --model NAME      load ./assets/NAME.obj and ./assets/NAME.png\n"
+      "  --headless        render offscreen without an SDL window\n"
+      "  --frames N        number of frames to render in headless mode\n"
+      "  --size WxH        headless framebuffer size (default 800x600)\n"
+      "  --output FILE     headless output: FILE.ppm saves the last frame,\n"
+      "                    a printf pattern like frame_%%04d.ppm saves every\n"
+      "                    frame and FILE.raw streams raw RGBA frames\n"
+      "  --threads N       rasterizer threads, 0 draws without tiles\n"
+      "                    (default: one per CPU core)\n"
+      "  --kernel NAME     span and vertex kernels: scalar, sse2 or avx2\n"
+      "                    (default: the fastest the CPU supports)\n"
+      "  --visibility      rasterize triangle ids into a visibility buffer\n"
+      "                    and shade every pixel once (deferred texturing)\n"
+      "  --lazy-depth      clear the z-buffer block by block when the first\n"
+      "                    triangle of a frame touches a block\n"
+      "  --copy-present    draw into the color buffer and copy it into the\n"
+      "                    texture, instead of into the locked texture\n"
+      "  --pipeline        transform the geometry of the next frame on a\n"
+      "                    separate thread while this one is rasterized\n"
+      "  --async-present N draw frames on a separate thread into N (2 or 3)\n"
+      "                    buffers while the main thread presents them\n"
+      "  --benchmark       play a turntable over every model with a fixed\n"
+      "                    time step (--frames, 320x240 unless --size) and\n"
+      "                    compare the last frames with golden images\n"
+      "  --update-golden   save the last frames as the golden images\n"
+      "  --tolerance PCT   percentage of pixels allowed to differ from the\n"
+      "                    golden images (default 0.1)\n"
+      "  --hud             show the p50/p95/p99 time of every frame stage\n"
+      "                    (toggle with 7)\n"
+      "  --profile FILE    write the time of every frame stage to FILE.csv\n"
+      "  --trace FILE      write a timeline of the run to FILE.json on exit,\n"
+      "                    for chrome://tracing or Perfetto\n"
+      "  --optimize        reorder the mesh for the vertex cache and print\n"
+      "                    the ACMR before and after\n"
+      "  --no-cache        always parse the OBJ file, do not read or write\n"
+      "                    the binary mesh cache NAME.obj.cache\n"
+      "  --wireframe --fill --vertices --textured\n"
+      "                    render only the given modes\n",
+      program);
+}
 
-  setup();
+bool parse_arguments(int argc, char *argv[]) {
+  bool render_modes_given = false;
+  bool size_given = false;
+
+  for (int i = 1; i < argc; i++) {
+    char *arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(arg, "--headless") == 0) {
+      is_headless = true;
+    } else if (strcmp(arg, "--model") == 0 && has_value) {
+      char *name = argv[++i];
+      snprintf(obj_filename, sizeof(obj_filename), "./assets/%s.obj", name);
+      snprintf(png_filename, sizeof(png_filename), "./assets/%s.png", name);
+    } else if (strcmp(arg, "--frames") == 0 && has_value) {
+      headless_frames = atoi(argv[++i]);
+    } else if (strcmp(arg, "--size") == 0 && has_value) {
+      if (sscanf(argv[++i], "%dx%d", &headless_width, &headless_height) != 2 ||
+          headless_width <= 0 || headless_height <= 0) {
+        fprintf(stderr, "Invalid size %s, expected WxH.\n", argv[i]);
+        return false;
+      }
+      size_given = true;
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      raster_threads = atoi(argv[++i]);
+      if (raster_threads < 0) raster_threads = 0;
+    } else if (strcmp(arg, "--kernel") == 0 && has_value) {
+      span_kernel = argv[++i];
+    } else if (strcmp(arg, "--visibility") == 0) {
+      USE_VISIBILITY_BUFFER = true;
+    } else if (strcmp(arg, "--lazy-depth") == 0) {
+      LAZY_DEPTH_CLEAR = true;
+    } else if (strcmp(arg, "--copy-present") == 0) {
+      ZERO_COPY_PRESENT = false;
+    } else if (strcmp(arg, "--pipeline") == 0) {
+      pipeline_geometry = true;
+    } else if (strcmp(arg, "--async-present") == 0 && has_value) {
+      num_present_buffers = atoi(argv[++i]);
+      if (num_present_buffers < 2) num_present_buffers = 2;
+      if (num_present_buffers > MAX_PRESENT_BUFFERS) {
+        num_present_buffers = MAX_PRESENT_BUFFERS;
+      }
+    } else if (strcmp(arg, "--benchmark") == 0) {
+      is_benchmark = true;
+      is_headless = true;
+    } else if (strcmp(arg, "--update-golden") == 0) {
+      update_golden_images = true;
+    } else if (strcmp(arg, "--tolerance") == 0 && has_value) {
+      golden_tolerance = atof(argv[++i]);
+    } else if (strcmp(arg, "--hud") == 0) {
+      SHOW_PROFILE_HUD = true;
+    } else if (strcmp(arg, "--profile") == 0 && has_value) {
+      profile_filename = argv[++i];
+    } else if (strcmp(arg, "--trace") == 0 && has_value) {
+      trace_filename = argv[++i];
+    } else if (strcmp(arg, "--optimize") == 0) {
+      optimize_mesh = true;
+    } else if (strcmp(arg, "--no-cache") == 0) {
+      use_mesh_cache = false;
+    } else if (strcmp(arg, "--output") == 0 && has_value) {
+      output_filename = argv[++i];
+    } else if (strcmp(arg, "--wireframe") == 0 ||
+               strcmp(arg, "--fill") == 0 ||
+               strcmp(arg, "--vertices") == 0 ||
+               strcmp(arg, "--textured") == 0) {
+      // The first explicit mode switches off all the default ones
+      if (!render_modes_given) {
+        RENDER_WIREFRAME = RENDER_FILL = RENDER_VERTICES = RENDER_TEXTURED =
+            false;
+        render_modes_given = true;
+      }
+      if (strcmp(arg, "--wireframe") == 0) RENDER_WIREFRAME = true;
+      if (strcmp(arg, "--fill") == 0) RENDER_FILL = true;
+      if (strcmp(arg, "--vertices") == 0) RENDER_VERTICES = true;
+      if (strcmp(arg, "--textured") == 0) RENDER_TEXTURED = true;
+    } else {
+      print_usage(argv[0]);
+      return false;
+    }
+  }
 
-  // game loop
-  while (is_running) {
-    process_input();
+  // The golden images of the benchmark are small, to keep them in the repo
+  if (is_benchmark && !size_given) {
+    headless_width = 320;
+    headless_height = 240;
+  }
+
+  return true;
+}
+
+// Render a fixed number of frames offscreen and report the throughput
+void run_headless(void) {
+  FILE *raw_file = NULL;
+  bool save_every_frame = false;
+
+  if (output_filename) {
+    char *extension = strrchr(output_filename, '.');
+    if (extension && strcmp(extension, ".raw") == 0) {
+      raw_file = fopen(output_filename, "wb");
+      if (!raw_file) {
+        fprintf(stderr, "Error opening %s for writing.\n", output_filename);
+        return;
+      }
+    } else {
+      save_every_frame = strchr(output_filename, '%') != NULL;
+    }
+  }
+
+  uint64_t render_ticks = 0;
+
+  // Start the geometry of the first frame, so the pipeline writes the same
+  // frames as the serial loop
+  if (geometry_thread) {
+    update();
+  }
+
+  for (int frame = 0; frame < headless_frames; frame++) {
+    uint64_t start = SDL_GetPerformanceCounter();
     update();
     render();
+    render_ticks += SDL_GetPerformanceCounter() - start;
+
+    profile_begin(PROFILE_PRESENT);
+    if (raw_file) {
+      write_color_buffer_raw(raw_file);
+    } else if (save_every_frame) {
+      char filename[512];
+      snprintf(filename, sizeof(filename), output_filename, frame);
+      save_color_buffer_ppm(filename);
+    }
+    profile_end(PROFILE_PRESENT);
+    profile_end_frame();
+    end_pipeline_stats_frame();
+  }
+
+  if (raw_file) {
+    fclose(raw_file);
+  } else if (output_filename && !save_every_frame) {
+    save_color_buffer_ppm(output_filename);
   }
 
+  double total_ms = render_ticks * 1000.0 / SDL_GetPerformanceFrequency();
+  printf(
+      "%s: %d frames at %dx%d, %d triangles (%d submitted, %d culled), %s "
+      "kernels, %.3f ms/frame, %.1f fps\n",
+      obj_filename, headless_frames, window_width, window_height,
+      num_triangles_to_render, get_pipeline_stat(STAT_FACES_PROCESSED),
+      get_pipeline_stat(STAT_FACES_CULLED), span_kernel_name,
+      headless_frames > 0 ? total_ms / headless_frames : 0.0,
+      total_ms > 0 ? headless_frames * 1000.0 / total_ms : 0.0);
+  printf("Pipeline statistics of the last frame:\n");
+  print_pipeline_stats();
+}
+
+// Pose the mesh and the camera for a frame of the benchmark: the mesh turns
+// around once over all the frames while it rocks and the camera sways. The
+// last frame has the same pose whatever the number of frames, so it can be
+// compared with the golden images.
+void play_turntable_script(int frame, int num_frames) {
+  float t = num_frames > 1 ? (float)frame / (num_frames - 1) : 1;
+  float angle = 2 * M_PI * t;
+  mesh.rotation.x = 0.3 * sin(angle);
+  mesh.rotation.y = angle;
+  mesh.rotation.z = 0;
+  camera.position.x = 0.5 * sin(angle);
+  camera.position.y = 0.3 * sin(2 * angle);
+  camera.position.z = -0.5 + 0.5 * cos(angle);
+  camera.yaw = 0.1 * sin(angle);
+}
+
+int compare_frame_times(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Pipeline statistics of the last frame of a model, on one line
+void print_benchmark_stats(void) {
+  int tested = get_pipeline_stat(STAT_PIXELS_TESTED);
+  int passed = get_pipeline_stat(STAT_PIXELS_PASSED);
+  printf(
+      "        %d faces, %d culled, %d rejected, %d pixels tested, %d z-pass, "
+      "%d z-fail, %d shaded, %d texels\n",
+      get_pipeline_stat(STAT_FACES_PROCESSED),
+      get_pipeline_stat(STAT_FACES_CULLED),
+      get_pipeline_stat(STAT_TRIANGLES_REJECTED), tested, passed,
+      tested - passed, get_pipeline_stat(STAT_PIXELS_SHADED),
+      get_pipeline_stat(STAT_TEXELS_FETCHED));
+}
+
+// Play the turntable script over every model, print the frame time
+// statistics and check the last frame of every model against its golden
+// image. Return true if all of them match.
+bool run_benchmark(void) {
+  int num_frames = headless_frames > 0 ? headless_frames : 1;
+  double *frame_times = (double *)malloc(sizeof(double) * num_frames);
+  double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+  int num_matching = 0;
+
+  printf("Benchmark: %d frames per model at %dx%d, %s kernels\n", num_frames,
+         window_width, window_height, span_kernel_name);
+
+  for (int i = 0; i < NUM_BENCHMARK_MODELS; i++) {
+    char *name = benchmark_models[i];
+    snprintf(obj_filename, sizeof(obj_filename), "./assets/%s.obj", name);
+    snprintf(png_filename, sizeof(png_filename), "./assets/%s.png", name);
+    load_model();
+
+    // Models without a texture are drawn with their flat color
+    RENDER_WIREFRAME = RENDER_VERTICES = false;
+    RENDER_TEXTURED = mesh_texture != NULL;
+    RENDER_FILL = !RENDER_TEXTURED;
+
+    // With --pipeline the geometry runs a frame ahead of the raster stage, so
+    // start the first one and play the script one frame ahead as well
+    initialize_geometry_thread();
+    int script_ahead = geometry_thread ? 1 : 0;
+    if (geometry_thread) {
+      play_turntable_script(0, num_frames);
+      update();
+    }
+
+    for (int frame = 0; frame < num_frames; frame++) {
+      uint64_t start = SDL_GetPerformanceCounter();
+      play_turntable_script(frame + script_ahead, num_frames);
+      update();
+      render();
+      frame_times[frame] = (SDL_GetPerformanceCounter() - start) * ms_per_tick;
+      profile_end_frame();
+      end_pipeline_stats_frame();
+    }
+
+    // The next model replaces the mesh the geometry thread reads
+    destroy_geometry_thread();
+
+    double total = 0;
+    for (int frame = 0; frame < num_frames; frame++) {
+      total += frame_times[frame];
+    }
+    qsort(frame_times, num_frames, sizeof(double), compare_frame_times);
+    printf(
+        "%-7s %.3f ms/frame mean, %.3f p50, %.3f p95, %.3f p99, %.3f max, ",
+        name, total / num_frames, frame_times[num_frames * 50 / 100],
+        frame_times[num_frames * 95 / 100], frame_times[num_frames * 99 / 100],
+        frame_times[num_frames - 1]);
+
+    char golden_filename[512];
+    snprintf(golden_filename, sizeof(golden_filename), "%s/%s_%dx%d.ppm",
+             golden_directory, name, window_width, window_height);
+    if (update_golden_images) {
+      bool saved = save_color_buffer_ppm(golden_filename);
+      printf("golden image %s\n", saved ? "saved" : "NOT SAVED");
+      num_matching += saved;
+      continue;
+    }
+
+    int num_different =
+        compare_color_buffer_ppm(golden_filename, GOLDEN_CHANNEL_TOLERANCE);
+    int num_allowed = window_width * window_height * golden_tolerance / 100;
+    if (num_different < 0) {
+      printf("no golden image %s\n", golden_filename);
+    } else if (num_different > num_allowed) {
+      printf("MISMATCH, %d pixels differ\n", num_different);
+    } else {
+      printf("ok, %d pixels differ\n", num_different);
+      num_matching++;
+    }
+    print_benchmark_stats();
+  }
+
+  printf("%d of %d models %s\n", num_matching, NUM_BENCHMARK_MODELS,
+         update_golden_images ? "saved" : "match their golden image");
+  free(frame_times);
+  return num_matching == NUM_BENCHMARK_MODELS;
+}
+
+int main(int argc, char *argv[]) {
+  if (!parse_arguments(argc, argv)) {
+    return 1;
+  }
+  if (profile_filename && !open_profile_csv(profile_filename)) {
+    return 1;
+  }
+  if (trace_filename && !open_trace(trace_filename)) {
+    return 1;
+  }
+  set_trace_thread_name("main");
+  bool benchmark_passed = true;
+
+  if (is_headless) {
+    if (!initialize_headless(headless_width, headless_height)) {
+      return 1;
+    }
+    setup();
+    if (is_benchmark) {
+      benchmark_passed = run_benchmark();
+    } else {
+      initialize_geometry_thread();
+      run_headless();
+    }
+  } else {
+    is_running = initialize_window();
+
+    setup();
+    initialize_geometry_thread();
+
+    if (is_running && num_present_buffers > 0) {
+      run_async_present();
+    }
+
+    // game loop
+    while (is_running && num_present_buffers == 0) {
+      trace_begin("frame");
+      profile_begin(PROFILE_INPUT);
+      process_input();
+      profile_end(PROFILE_INPUT);
+      update();
+      render();
+      profile_end_frame();
+      end_pipeline_stats_frame();
+      trace_end();
+    }
+  }
+
+  close_profile_csv();
   destroy_window();
   free_resources();
+  // After the geometry thread has finished its last frame and been joined
+  close_trace();
 
-  return 0;
+  return benchmark_passed ? 0 : 1;
 }
\ No newline at end of file
@@ -1,6 +1,13 @@
 #include "matrix.h"
 
+#include <SDL2/SDL.h>
 #include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86_SIMD
+#include <immintrin.h>
+#endif
 
 mat4_t mat4_identity(void) {
   // | 1 0 0 0 |
@@ -156,4 +163,154 @@ mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up) {
                          {z.x, z.y, z.z, -vec3_dot(z, eye)},
                          {0, 0, 0, 1}}};
   return view_matrix;
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batched matrix-vector multiplication
+///////////////////////////////////////////////////////////////////////////////
+//
+// Multiplying the vectors one by one passes the whole matrix by value on every
+// call. The batch versions broadcast every element of the matrix once and then
+// stream through the structure of arrays, transforming 4 (SSE2) or 8 (AVX2)
+// vectors per iteration with the same operations in the same order as
+// mat4_mul_vec4, so all the versions give the exact same results. The vectors
+// at the end that do not fill a whole register go through the scalar version.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void (*mat4_mul_vec4_batch)(mat4_t m, vec4_soa_t* in, vec4_soa_t* out,
+                            int count, bool project) =
+    mat4_mul_vec4_batch_scalar;
+
+void mat4_mul_vec4_batch_scalar(mat4_t m, vec4_soa_t* in, vec4_soa_t* out,
+                                int count, bool project) {
+  for (int i = 0; i < count; i++) {
+    vec4_t v = vec4_soa_get(in, i);
+    vec4_t result = project ? mat4_mul_vec4_project(m, v) : mat4_mul_vec4(m, v);
+    out->x[i] = result.x;
+    out->y[i] = result.y;
+    out->z[i] = result.z;
+    out->w[i] = result.w;
+  }
+}
+
+// View of the vectors of soa from index i on
+vec4_soa_t vec4_soa_tail(vec4_soa_t* soa, int i) {
+  vec4_soa_t tail = {soa->x + i, soa->y + i, soa->z + i, soa->w + i, NULL,
+                     soa->capacity - i};
+  return tail;
+}
+
+#ifdef MATRIX_X86_SIMD
+
+__attribute__((target("sse2"))) void mat4_mul_vec4_batch_sse2(
+    mat4_t m, vec4_soa_t* in, vec4_soa_t* out, int count, bool project) {
+  __m128 rows[4][4];
+  for (int row = 0; row < 4; row++) {
+    for (int col = 0; col < 4; col++) {
+      rows[row][col] = _mm_set1_ps(m.m[row][col]);
+    }
+  }
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(in->x + i);
+    __m128 y = _mm_loadu_ps(in->y + i);
+    __m128 z = _mm_loadu_ps(in->z + i);
+    __m128 w = _mm_loadu_ps(in->w + i);
+
+    __m128 result[4];
+    for (int row = 0; row < 4; row++) {
+      result[row] = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[row][0], x),
+                                _mm_mul_ps(rows[row][1], y)),
+                     _mm_mul_ps(rows[row][2], z)),
+          _mm_mul_ps(rows[row][3], w));
+    }
+
+    if (project) {
+      // Perspective divide, except in the lanes where w is zero
+      __m128 zero_w = _mm_cmpeq_ps(result[3], _mm_setzero_ps());
+      for (int row = 0; row < 3; row++) {
+        __m128 divided = _mm_div_ps(result[row], result[3]);
+        result[row] = _mm_or_ps(_mm_and_ps(zero_w, result[row]),
+                                _mm_andnot_ps(zero_w, divided));
+      }
+    }
+
+    _mm_storeu_ps(out->x + i, result[0]);
+    _mm_storeu_ps(out->y + i, result[1]);
+    _mm_storeu_ps(out->z + i, result[2]);
+    _mm_storeu_ps(out->w + i, result[3]);
+  }
+
+  vec4_soa_t in_tail = vec4_soa_tail(in, i);
+  vec4_soa_t out_tail = vec4_soa_tail(out, i);
+  mat4_mul_vec4_batch_scalar(m, &in_tail, &out_tail, count - i, project);
+}
+
+__attribute__((target("avx2"))) void mat4_mul_vec4_batch_avx2(
+    mat4_t m, vec4_soa_t* in, vec4_soa_t* out, int count, bool project) {
+  __m256 rows[4][4];
+  for (int row = 0; row < 4; row++) {
+    for (int col = 0; col < 4; col++) {
+      rows[row][col] = _mm256_set1_ps(m.m[row][col]);
+    }
+  }
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(in->x + i);
+    __m256 y = _mm256_loadu_ps(in->y + i);
+    __m256 z = _mm256_loadu_ps(in->z + i);
+    __m256 w = _mm256_loadu_ps(in->w + i);
+
+    __m256 result[4];
+    for (int row = 0; row < 4; row++) {
+      result[row] = _mm256_add_ps(
+          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rows[row][0], x),
+                                      _mm256_mul_ps(rows[row][1], y)),
+                        _mm256_mul_ps(rows[row][2], z)),
+          _mm256_mul_ps(rows[row][3], w));
+    }
+
+    if (project) {
+      // Perspective divide, except in the lanes where w is zero
+      __m256 zero_w =
+          _mm256_cmp_ps(result[3], _mm256_setzero_ps(), _CMP_EQ_OQ);
+      for (int row = 0; row < 3; row++) {
+        __m256 divided = _mm256_div_ps(result[row], result[3]);
+        result[row] = _mm256_blendv_ps(divided, result[row], zero_w);
+      }
+    }
+
+    _mm256_storeu_ps(out->x + i, result[0]);
+    _mm256_storeu_ps(out->y + i, result[1]);
+    _mm256_storeu_ps(out->z + i, result[2]);
+    _mm256_storeu_ps(out->w + i, result[3]);
+  }
+
+  // Leave the AVX state clean before running non-AVX code again
+  _mm256_zeroupper();
+
+  vec4_soa_t in_tail = vec4_soa_tail(in, i);
+  vec4_soa_t out_tail = vec4_soa_tail(out, i);
+  mat4_mul_vec4_batch_scalar(m, &in_tail, &out_tail, count - i, project);
+}
+
+#endif
+
+// Select the widest batch kernel the CPU supports, or the one named by name
+// ("scalar", "sse2" or "avx2") if the CPU supports it
+void initialize_matrix_kernels(char* name) {
+  mat4_mul_vec4_batch = mat4_mul_vec4_batch_scalar;
+
+#ifdef MATRIX_X86_SIMD
+  bool any = name == NULL;
+  if ((any || strcmp(name, "avx2") == 0) && SDL_HasAVX2()) {
+    mat4_mul_vec4_batch = mat4_mul_vec4_batch_avx2;
+  } else if ((any || strcmp(name, "sse2") == 0) && SDL_HasSSE2()) {
+    mat4_mul_vec4_batch = mat4_mul_vec4_batch_sse2;
+  }
+#endif
+}
@@ -19,4 +19,16 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
 vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
 mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
 
+// Multiply the matrix by the first count vectors of in and store the results
+// in out, dividing them by w like mat4_mul_vec4_project if project is true.
+// It points to the fastest version the CPU supports after
+// initialize_matrix_kernels.
+extern void (*mat4_mul_vec4_batch)(mat4_t m, vec4_soa_t* in, vec4_soa_t* out,
+                                   int count, bool project);
+
+void initialize_matrix_kernels(char* name);
+
+void mat4_mul_vec4_batch_scalar(mat4_t m, vec4_soa_t* in, vec4_soa_t* out,
+                                int count, bool project);
+
 #endif
\ No newline at end of file
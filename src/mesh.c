@@ -1,14 +1,19 @@
 #include "mesh.h"
 
+#include <SDL2/SDL.h>
+#include <limits.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "array.h"
-
-#define LINE_BUFFER_SIZE 512
+#include "file_map.h"
 
 mesh_t mesh = {.vertices = NULL,
+               .texcoords = NULL,
                .faces = NULL,
                .rotation = {.x = 0, .y = 0, .z = 0},
                .scale = {.x = 1.0, .y = 1.0, .z = 1.0},
@@ -25,7 +30,7 @@ vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z = 1}    // 8
 };
 
-face_t cube_faces[N_CUBE_FACES] = {
+loaded_face_t cube_faces[N_CUBE_FACES] = {
     // front
     {.a = 1,
      .b = 2,
@@ -118,59 +123,811 @@ face_t cube_faces[N_CUBE_FACES] = {
      .color = 0xFFFFFFFF}};
 
 void load_cube_mesh_data(void) {
-  for (int i = 0; i < N_CUBE_VERTICES; i++) {
-    vec3_t cube_vertex = cube_vertices[i];
-    array_push(mesh.vertices, cube_vertex);
+  weld_mesh_faces(cube_vertices, cube_faces, N_CUBE_FACES);
+  update_vertex_stream();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Vertex welding
+///////////////////////////////////////////////////////////////////////////////
+//
+// Models index positions and texture coordinates separately, and often repeat
+// the same position on several lines. Welding builds one vertex buffer where
+// every unique (position, texture coordinates) pair is stored once, found
+// through an open addressing hash table, and faces become three indices into
+// it. Vertices are compared bit for bit.
+//
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  vec3_t position;
+  tex2_t texcoord;
+} weld_vertex_t;
+
+uint32_t hash_weld_vertex(weld_vertex_t* vertex) {
+  uint32_t words[5];
+  memcpy(words, vertex, sizeof(words));
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 5; i++) {
+    hash = (hash ^ words[i]) * 16777619u;
   }
-  for (int i = 0; i < N_CUBE_FACES; i++) {
-    face_t cube_face = cube_faces[i];
-    array_push(mesh.faces, cube_face);
+  return hash ^ (hash >> 16);
+}
+
+// Append the vertices of the faces to the mesh, sharing the equal ones, and
+// append the faces indexing them
+void weld_mesh_faces(vec3_t* positions, loaded_face_t* faces, int num_faces) {
+  int num_slots = 16;
+  while (num_slots < num_faces * 6) num_slots *= 2;  // load factor <= 1/2
+  int* slots = (int*)malloc(sizeof(int) * num_slots);
+  face_t* faces_held = array_hold(mesh.faces, num_faces, sizeof(face_t));
+  if (!slots || !faces_held) {
+    fprintf(stderr, "Error allocating the faces of the mesh.\n");
+    free(slots);
+    return;
+  }
+  for (int i = 0; i < num_slots; i++) slots[i] = -1;
+
+  int first_face = array_length(faces_held) - num_faces;
+  mesh.faces = faces_held;
+
+  for (int i = 0; i < num_faces; i++) {
+    loaded_face_t* face = &faces[i];
+    weld_vertex_t corners[3] = {{positions[face->a], face->a_uv},
+                                {positions[face->b], face->b_uv},
+                                {positions[face->c], face->c_uv}};
+    int indices[3];
+    for (int j = 0; j < 3; j++) {
+      int slot = hash_weld_vertex(&corners[j]) & (num_slots - 1);
+      while (slots[slot] >= 0) {
+        int index = slots[slot];
+        if (memcmp(&mesh.vertices[index], &corners[j].position,
+                   sizeof(vec3_t)) == 0 &&
+            memcmp(&mesh.texcoords[index], &corners[j].texcoord,
+                   sizeof(tex2_t)) == 0) {
+          break;
+        }
+        slot = (slot + 1) & (num_slots - 1);
+      }
+      if (slots[slot] < 0) {
+        slots[slot] = array_length(mesh.vertices);
+        array_push(mesh.vertices, corners[j].position);
+        array_push(mesh.texcoords, corners[j].texcoord);
+        if (array_length(mesh.vertices) != slots[slot] + 1 ||
+            array_length(mesh.texcoords) != slots[slot] + 1) {
+          // Leave an empty mesh rather than faces indexing missing vertices
+          free(slots);
+          free_mesh();
+          return;
+        }
+      }
+      indices[j] = slots[slot];
+    }
+
+    face_t welded = {.a = indices[0],
+                     .b = indices[1],
+                     .c = indices[2],
+                     .color = face->color};
+    mesh.faces[first_face + i] = welded;
   }
+  free(slots);
 }
 
-void load_obj_file_data(char* filename) {
-  FILE* file;
-  file = fopen(filename, "r");
+///////////////////////////////////////////////////////////////////////////////
+// OBJ tokenizer
+///////////////////////////////////////////////////////////////////////////////
+//
+// The OBJ file is parsed in place from its memory mapping. The mapping is not
+// NUL terminated, so every function gets the end of the data and never reads
+// past it. Numbers are parsed by hand, sscanf has to handle locales and
+// formats and is several times slower for the simple numbers OBJ files have.
+//
+///////////////////////////////////////////////////////////////////////////////
+typedef enum {
+  OBJ_OTHER,
+  OBJ_VERTEX,    // v x y z
+  OBJ_TEXCOORD,  // vt u v
+  OBJ_FACE       // f v/vt/vn v/vt/vn v/vt/vn
+} obj_record_t;
+
+bool is_obj_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+char* skip_obj_blanks(char* p, char* end) {
+  while (p < end && is_obj_blank(*p)) p++;
+  return p;
+}
+
+// Return the first character of the next line
+char* skip_obj_line(char* p, char* end) {
+  char* newline = memchr(p, '\n', end - p);
+  return newline ? newline + 1 : end;
+}
+
+// Return the type of the record of the line at p and move p past its keyword
+obj_record_t read_obj_record(char** p, char* end) {
+  char* line = *p;
+  size_t length = end - line;
+  if (length >= 2 && line[0] == 'v' && is_obj_blank(line[1])) {
+    *p = line + 2;
+    return OBJ_VERTEX;
+  }
+  if (length >= 3 && line[0] == 'v' && line[1] == 't' &&
+      is_obj_blank(line[2])) {
+    *p = line + 3;
+    return OBJ_TEXCOORD;
+  }
+  if (length >= 2 && line[0] == 'f' && is_obj_blank(line[1])) {
+    *p = line + 2;
+    return OBJ_FACE;
+  }
+  return OBJ_OTHER;
+}
+
+// Parse an optionally signed integer, return NULL if there are no digits.
+// Values too large for an int are clamped to INT_MAX.
+char* parse_obj_int(char* p, char* end, int* value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p >= end || *p < '0' || *p > '9') {
+    return NULL;
+  }
+
+  int result = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    int digit = *p - '0';
+    result = result > (INT_MAX - digit) / 10 ? INT_MAX : result * 10 + digit;
+    p++;
+  }
+  *value = negative ? -result : result;
+  return p;
+}
+
+// Parse a decimal float with an optional exponent, return NULL if there are
+// no digits. The digits are gathered into an integer and scaled by a power of
+// ten at the end, which is exact for the number of digits OBJ exporters write.
+char* parse_obj_float(char* p, char* end, float* value) {
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-  char line[LINE_BUFFER_SIZE];
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
 
-  tex2_t* texcoords = NULL;
+  uint64_t mantissa = 0;
+  int num_digits = 0;
+  int exponent = 0;
+  bool has_digits = false;
 
-  while (fgets(line, LINE_BUFFER_SIZE, file)) {
-    // Vertex information
-    if (strncmp(line, "v ", 2) == 0) {
-      vec3_t vertex;
-      sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-      array_push(mesh.vertices, vertex);
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    has_digits = true;
+    if (num_digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      num_digits += mantissa > 0;
+    } else {
+      exponent++;  // digits past the precision of the mantissa
     }
-    // Texture coordinate information
-    if (strncmp(line, "vt ", 3) == 0) {
-      tex2_t textcoord;
-      sscanf(line, "vt %f %f", &textcoord.u, &textcoord.v);
-      array_push(texcoords, textcoord);
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      has_digits = true;
+      if (num_digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        num_digits += mantissa > 0;
+        exponent--;
+      }
     }
+  }
+  if (!has_digits) {
+    return NULL;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int exponent_value;
+    char* after = parse_obj_int(p + 1, end, &exponent_value);
+    if (after) {
+      exponent += exponent_value;
+      p = after;
+    }
+  }
 
-    // Face information
-    if (strncmp(line, "f ", 2) == 0) {
+  double result = (double)mantissa;
+  if (exponent >= 0 && exponent <= 22) {
+    result *= powers_of_ten[exponent];
+  } else if (exponent < 0 && exponent >= -22) {
+    result /= powers_of_ten[-exponent];
+  } else {
+    result *= pow(10.0, exponent);
+  }
+  *value = (float)(negative ? -result : result);
+  return p;
+}
+
+// Parse the floats of a record into values, missing ones are left untouched
+char* parse_obj_floats(char* p, char* end, float* values, int count) {
+  for (int i = 0; i < count; i++) {
+    char* after = parse_obj_float(skip_obj_blanks(p, end), end, &values[i]);
+    if (!after) {
+      break;
+    }
+    p = after;
+  }
+  return p;
+}
+
+// Parse one v/vt/vn corner of a face. The texture and normal indices are
+// optional (v, v/vt, v//vn and v/vt/vn are all valid) and are 0 if missing.
+char* parse_obj_corner(char* p, char* end, int* vertex, int* texcoord) {
+  *texcoord = 0;
+  p = parse_obj_int(skip_obj_blanks(p, end), end, vertex);
+  if (!p) {
+    return NULL;
+  }
+
+  if (p < end && *p == '/') {
+    p++;
+    char* after = parse_obj_int(p, end, texcoord);
+    if (after) {
+      p = after;
+    }
+    if (p < end && *p == '/') {
+      int normal;
+      after = parse_obj_int(p + 1, end, &normal);
+      p = after ? after : p + 1;
+    }
+  }
+  return p;
+}
+
+// Turn a 1-based OBJ index, or a negative one relative to the count elements
+// read so far, into a 0-based index. Return -1 if it is not below total, or
+// if it is 0, which is both invalid and what a missing index is parsed as.
+int resolve_obj_index(int index, int count, int total) {
+  if (index == 0) {
+    return -1;
+  }
+  int resolved = index > 0 ? index - 1 : count + index;
+  return resolved >= 0 && resolved < total ? resolved : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load the vertices and faces of an OBJ file
+///////////////////////////////////////////////////////////////////////////////
+//
+// The file is memory-mapped and split at line boundaries into one chunk per
+// CPU core (big files only, small ones are a single chunk). Every pass runs on
+// all the chunks in parallel:
+//
+//   1. Count the v, vt and f records of the chunk.
+//   2. Parse the vertices and texture coordinates of the chunk straight into
+//      their place in the arrays. A prefix sum of the counts of the previous
+//      chunks gives the index of the first record of every chunk.
+//   3. Parse the faces. Relative (negative) indices are fixed up with the
+//      index of the first vertex and texture coordinate of the chunk, and the
+//      UVs are looked up in the texture coordinates parsed by all the chunks.
+//
+// The arrays are sized once after the first pass, then the faces are welded
+// into the vertex buffer of the mesh.
+//
+///////////////////////////////////////////////////////////////////////////////
+#define OBJ_MAX_CHUNKS 64
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+  char* start;
+  char* end;
+  int num_vertices;  // number of records of every type in the chunk
+  int num_texcoords;
+  int num_faces;
+  int first_vertex;  // index of the first record of every type of the chunk
+  int first_texcoord;
+  int first_face;
+  int num_loaded_faces;  // faces that were not skipped
+} obj_chunk_t;
+
+// Arrays the chunks of the file being loaded are parsed into
+vec3_t* obj_vertices = NULL;
+tex2_t* obj_texcoords = NULL;
+loaded_face_t* obj_faces = NULL;
+int obj_total_vertices = 0;
+int obj_total_texcoords = 0;
+
+void count_obj_chunk(obj_chunk_t* chunk) {
+  chunk->num_vertices = 0;
+  chunk->num_texcoords = 0;
+  chunk->num_faces = 0;
+  for (char* line = chunk->start; line < chunk->end;
+       line = skip_obj_line(line, chunk->end)) {
+    char* p = line;
+    switch (read_obj_record(&p, chunk->end)) {
+      case OBJ_VERTEX:
+        chunk->num_vertices++;
+        break;
+      case OBJ_TEXCOORD:
+        chunk->num_texcoords++;
+        break;
+      case OBJ_FACE:
+        chunk->num_faces++;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void parse_obj_chunk_vertices(obj_chunk_t* chunk) {
+  vec3_t* vertex = obj_vertices + chunk->first_vertex;
+  tex2_t* texcoord = obj_texcoords + chunk->first_texcoord;
+
+  for (char* line = chunk->start; line < chunk->end;
+       line = skip_obj_line(line, chunk->end)) {
+    char* p = line;
+    switch (read_obj_record(&p, chunk->end)) {
+      case OBJ_VERTEX: {
+        float values[3] = {0, 0, 0};
+        parse_obj_floats(p, chunk->end, values, 3);
+        vertex->x = values[0];
+        vertex->y = values[1];
+        vertex->z = values[2];
+        vertex++;
+        break;
+      }
+      case OBJ_TEXCOORD: {
+        float values[2] = {0, 0};
+        parse_obj_floats(p, chunk->end, values, 2);
+        texcoord->u = values[0];
+        texcoord->v = values[1];
+        texcoord++;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+void parse_obj_chunk_faces(obj_chunk_t* chunk) {
+  // Records read so far, relative indices count back from them
+  int vertex_count = chunk->first_vertex;
+  int texcoord_count = chunk->first_texcoord;
+  loaded_face_t* faces = obj_faces + chunk->first_face;
+  chunk->num_loaded_faces = 0;
+
+  for (char* line = chunk->start; line < chunk->end;
+       line = skip_obj_line(line, chunk->end)) {
+    char* p = line;
+    obj_record_t record = read_obj_record(&p, chunk->end);
+    if (record == OBJ_VERTEX) {
+      vertex_count++;
+    } else if (record == OBJ_TEXCOORD) {
+      texcoord_count++;
+    } else if (record == OBJ_FACE) {
+      // Only the first three corners are used, faces are triangles
       int vertex_indices[3];
-      int texture_indices[3];
-      int normal_indices[3];
-      sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &vertex_indices[0],
-             &texture_indices[0], &normal_indices[0], &vertex_indices[1],
-             &texture_indices[1], &normal_indices[1], &vertex_indices[2],
-             &texture_indices[2], &normal_indices[2]);
-      // -1 as a compensation for vertex
-      // indexing in the mesh_faces
-      face_t face = {.a = vertex_indices[0] - 1,
-                     .b = vertex_indices[1] - 1,
-                     .c = vertex_indices[2] - 1,
-                     .a_uv = texcoords[texture_indices[0] - 1],
-                     .b_uv = texcoords[texture_indices[1] - 1],
-                     .c_uv = texcoords[texture_indices[2] - 1],
-                     .color = 0xFFFFFFFF};
-      array_push(mesh.faces, face);
+      tex2_t uvs[3];
+      bool valid = true;
+      for (int j = 0; j < 3 && valid; j++) {
+        int vertex_index, texture_index;
+        p = parse_obj_corner(p, chunk->end, &vertex_index, &texture_index);
+        vertex_indices[j] = p ? resolve_obj_index(vertex_index, vertex_count,
+                                                  obj_total_vertices)
+                              : -1;
+        valid = vertex_indices[j] >= 0;
+
+        int texcoord = p ? resolve_obj_index(texture_index, texcoord_count,
+                                             obj_total_texcoords)
+                         : -1;
+        // Corners without a texture index get the default 0, 0
+        uvs[j] = texcoord >= 0 ? obj_texcoords[texcoord] : (tex2_t){0, 0};
+      }
+      if (!valid) {
+        continue;  // skip faces with missing or out of range vertices
+      }
+
+      loaded_face_t face = {.a = vertex_indices[0],
+                            .b = vertex_indices[1],
+                            .c = vertex_indices[2],
+                            .a_uv = uvs[0],
+                            .b_uv = uvs[1],
+                            .c_uv = uvs[2],
+                            .color = 0xFFFFFFFF};
+      faces[chunk->num_loaded_faces++] = face;
     }
   }
+}
 
-  array_free(texcoords);
-}
\ No newline at end of file
+typedef struct {
+  void (*pass)(obj_chunk_t* chunk);
+  obj_chunk_t* chunk;
+} obj_pass_job_t;
+
+int run_obj_pass_job(void* data) {
+  obj_pass_job_t* job = (obj_pass_job_t*)data;
+  job->pass(job->chunk);
+  return 0;
+}
+
+// Run a pass on every chunk, each one on its own thread
+void run_obj_pass(void (*pass)(obj_chunk_t* chunk), obj_chunk_t* chunks,
+                  int num_chunks) {
+  obj_pass_job_t jobs[OBJ_MAX_CHUNKS];
+  SDL_Thread* threads[OBJ_MAX_CHUNKS];
+
+  for (int i = 1; i < num_chunks; i++) {
+    jobs[i].pass = pass;
+    jobs[i].chunk = &chunks[i];
+    threads[i] = SDL_CreateThread(run_obj_pass_job, "obj_loader", &jobs[i]);
+    if (!threads[i]) {
+      pass(&chunks[i]);  // no thread, parse the chunk on this one
+    }
+  }
+  pass(&chunks[0]);
+  for (int i = 1; i < num_chunks; i++) {
+    if (threads[i]) {
+      SDL_WaitThread(threads[i], NULL);
+    }
+  }
+}
+
+void load_obj_file_data(char* filename) {
+  file_map_t map;
+  if (!map_file(&map, filename)) {
+    fprintf(stderr, "Error opening %s.\n", filename);
+    return;
+  }
+
+  // Split the file into chunks that start at the beginning of a line
+  int num_chunks = SDL_GetCPUCount();
+  if (num_chunks > (int)(map.size / OBJ_MIN_CHUNK_SIZE)) {
+    num_chunks = (int)(map.size / OBJ_MIN_CHUNK_SIZE);
+  }
+  if (num_chunks > OBJ_MAX_CHUNKS) num_chunks = OBJ_MAX_CHUNKS;
+  if (num_chunks < 1) num_chunks = 1;
+
+  obj_chunk_t chunks[OBJ_MAX_CHUNKS];
+  char* end = map.data + map.size;
+  char* start = map.data;
+  for (int i = 0; i < num_chunks; i++) {
+    char* chunk_end = map.data + map.size / num_chunks * (i + 1);
+    chunk_end = i == num_chunks - 1 ? end : skip_obj_line(chunk_end, end);
+    chunks[i].start = start;
+    chunks[i].end = chunk_end < start ? start : chunk_end;
+    start = chunks[i].end;
+  }
+
+  run_obj_pass(count_obj_chunk, chunks, num_chunks);
+
+  // Prefix sums of the counts give the first record of every chunk
+  int num_vertices = 0;
+  int num_texcoords = 0;
+  int num_faces = 0;
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].first_vertex = num_vertices;
+    chunks[i].first_texcoord = num_texcoords;
+    chunks[i].first_face = num_faces;
+    num_vertices += chunks[i].num_vertices;
+    num_texcoords += chunks[i].num_texcoords;
+    num_faces += chunks[i].num_faces;
+  }
+
+  obj_vertices = (vec3_t*)malloc(sizeof(vec3_t) * (num_vertices + 1));
+  obj_texcoords = (tex2_t*)malloc(sizeof(tex2_t) * (num_texcoords + 1));
+  obj_faces = (loaded_face_t*)malloc(sizeof(loaded_face_t) * (num_faces + 1));
+  obj_total_vertices = num_vertices;
+  obj_total_texcoords = num_texcoords;
+
+  run_obj_pass(parse_obj_chunk_vertices, chunks, num_chunks);
+  run_obj_pass(parse_obj_chunk_faces, chunks, num_chunks);
+
+  // Close the gaps left by the faces that were skipped
+  int num_loaded_faces = 0;
+  for (int i = 0; i < num_chunks; i++) {
+    memmove(obj_faces + num_loaded_faces, obj_faces + chunks[i].first_face,
+            sizeof(loaded_face_t) * chunks[i].num_loaded_faces);
+    num_loaded_faces += chunks[i].num_loaded_faces;
+  }
+  weld_mesh_faces(obj_vertices, obj_faces, num_loaded_faces);
+
+  free(obj_vertices);
+  free(obj_texcoords);
+  free(obj_faces);
+  obj_vertices = NULL;
+  obj_texcoords = NULL;
+  obj_faces = NULL;
+  unmap_file(&map);
+  update_vertex_stream();
+}
+
+// Copy the vertices of the mesh into the structure of arrays that the batched
+// vertex transform reads
+void update_vertex_stream(void) {
+  int num_vertices = array_length(mesh.vertices);
+  if (!vec4_soa_reserve(&mesh.vertex_stream, num_vertices)) {
+    fprintf(stderr, "Error allocating the vertex stream.\n");
+    return;
+  }
+
+  for (int i = 0; i < num_vertices; i++) {
+    mesh.vertex_stream.x[i] = mesh.vertices[i].x;
+    mesh.vertex_stream.y[i] = mesh.vertices[i].y;
+    mesh.vertex_stream.z[i] = mesh.vertices[i].z;
+    mesh.vertex_stream.w[i] = 1.0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary mesh cache
+///////////////////////////////////////////////////////////////////////////////
+//
+// The first load of an OBJ file writes the parsed mesh next to it, in
+// NAME.obj.cache. The file is laid out exactly like the arrays of mesh_t:
+//
+//   header | vertices | texcoords | faces | vertex stream x, y, z, w
+//
+// Every block starts at a multiple of MESH_CACHE_ALIGNMENT, and the vertices,
+// texture coordinates and faces are preceded by the header of array.h. Later
+// loads map the cache and point the mesh straight into it, without parsing or
+// copying anything. The cache is rebuilt when the size or the modification time
+// of the OBJ file no longer match the ones recorded in the header, or when it
+// was written with a different vertex cache optimization setting, or when its
+// arrays or face indices do not match the header. An optimized cache also keeps
+// the ACMR the optimization was reported with.
+//
+///////////////////////////////////////////////////////////////////////////////
+#define MESH_CACHE_MAGIC "MESHCACH"
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_ALIGNMENT 64
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t vertex_size;  // sizes of the structures the cache was written with
+  uint32_t texcoord_size;
+  uint32_t face_size;
+  uint32_t num_vertices;
+  uint32_t num_faces;
+  uint32_t stream_capacity;  // floats in each of the x, y, z, w arrays
+  uint32_t optimized;        // faces and vertices reordered for the cache
+  float acmr_before;         // vertex cache ACMR before and after reordering
+  float acmr_after;
+  uint64_t source_size;      // size and modification time of the OBJ file
+  int64_t source_mtime;
+  uint64_t vertices_offset;  // offsets of the blocks from the file start
+  uint64_t texcoords_offset;
+  uint64_t faces_offset;
+  uint64_t stream_offset;
+  uint64_t file_size;
+} mesh_cache_header_t;
+
+// Mapping of the cache the mesh points into, data is NULL when the mesh was
+// parsed from an OBJ file and owns its arrays
+file_map_t mesh_cache_map = {NULL, 0, NULL};
+
+void get_mesh_cache_filename(char* obj_filename, char* filename, int size) {
+  snprintf(filename, size, "%s.cache", obj_filename);
+}
+
+uint64_t align_mesh_cache_offset(uint64_t offset) {
+  return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT *
+         MESH_CACHE_ALIGNMENT;
+}
+
+// Lay out the blocks of a mesh and fill in the offsets of the header. The
+// vertex stream arrays are padded like the ones of vec4_soa_reserve.
+void layout_mesh_cache(mesh_cache_header_t* header) {
+  uint32_t lanes = VEC4_SOA_ALIGNMENT / sizeof(float);
+  header->stream_capacity = (header->num_vertices + lanes - 1) / lanes * lanes;
+
+  uint64_t offset = sizeof(mesh_cache_header_t);
+  header->vertices_offset = align_mesh_cache_offset(offset + ARRAY_HEADER_SIZE);
+  offset = header->vertices_offset +
+           (uint64_t)header->vertex_size * header->num_vertices;
+  header->texcoords_offset =
+      align_mesh_cache_offset(offset + ARRAY_HEADER_SIZE);
+  offset = header->texcoords_offset +
+           (uint64_t)header->texcoord_size * header->num_vertices;
+  header->faces_offset = align_mesh_cache_offset(offset + ARRAY_HEADER_SIZE);
+  offset = header->faces_offset +
+           (uint64_t)header->face_size * header->num_faces;
+  header->stream_offset = align_mesh_cache_offset(offset);
+  header->file_size =
+      header->stream_offset + 4 * sizeof(float) * header->stream_capacity;
+}
+
+// Write zeros up to offset, then size bytes of data
+bool write_mesh_cache_block(FILE* file, uint64_t* position, uint64_t offset,
+                            void* data, uint64_t size) {
+  static const char zeros[MESH_CACHE_ALIGNMENT] = {0};
+  while (*position < offset) {
+    uint64_t padding = offset - *position;
+    if (padding > MESH_CACHE_ALIGNMENT) padding = MESH_CACHE_ALIGNMENT;
+    if (fwrite(zeros, 1, padding, file) != padding) return false;
+    *position += padding;
+  }
+  if (size > 0 && fwrite(data, 1, size, file) != size) return false;
+  *position += size;
+  return true;
+}
+
+// Check the array lengths and the face indices of a cache with a valid
+// header, so a corrupt file can not make the geometry read past the vertices
+bool valid_mesh_cache_payload(mesh_cache_header_t* header, char* data) {
+  int num_vertices = (int)header->num_vertices;
+  int num_faces = (int)header->num_faces;
+  if (array_length(data + header->vertices_offset) != num_vertices ||
+      array_length(data + header->texcoords_offset) != num_vertices ||
+      array_length(data + header->faces_offset) != num_faces) {
+    return false;
+  }
+
+  face_t* faces = (face_t*)(data + header->faces_offset);
+  for (int i = 0; i < num_faces; i++) {
+    if (faces[i].a < 0 || faces[i].a >= num_vertices || faces[i].b < 0 ||
+        faces[i].b >= num_vertices || faces[i].c < 0 ||
+        faces[i].c >= num_vertices) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Load the mesh from the cache of obj_filename. When it was optimized the
+// ACMR before and after the optimization are returned in acmr.
+bool load_mesh_cache(char* obj_filename, bool optimized, float acmr[2]) {
+  if (mesh.vertices || mesh.texcoords || mesh.faces) {
+    return false;  // the cache holds a whole mesh, it can not be appended
+  }
+
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!get_file_info(obj_filename, &source_size, &source_mtime)) {
+    return false;
+  }
+
+  char filename[512];
+  get_mesh_cache_filename(obj_filename, filename, sizeof(filename));
+  file_map_t map;
+  if (!map_file(&map, filename)) {
+    return false;
+  }
+
+  // Check that the cache is up to date and that every block is in the file
+  mesh_cache_header_t header;
+  bool valid = map.size >= sizeof(header);
+  if (valid) {
+    memcpy(&header, map.data, sizeof(header));
+    mesh_cache_header_t expected = header;
+    layout_mesh_cache(&expected);
+    valid = memcmp(header.magic, MESH_CACHE_MAGIC, 8) == 0 &&
+            header.version == MESH_CACHE_VERSION &&
+            header.vertex_size == sizeof(vec3_t) &&
+            header.texcoord_size == sizeof(tex2_t) &&
+            header.face_size == sizeof(face_t) &&
+            header.num_vertices <= INT32_MAX &&
+            header.num_faces <= INT32_MAX &&
+            header.optimized == (uint32_t)optimized &&
+            header.source_size == source_size &&
+            header.source_mtime == source_mtime &&
+            header.stream_capacity == expected.stream_capacity &&
+            header.vertices_offset == expected.vertices_offset &&
+            header.texcoords_offset == expected.texcoords_offset &&
+            header.faces_offset == expected.faces_offset &&
+            header.stream_offset == expected.stream_offset &&
+            header.file_size == expected.file_size &&
+            header.file_size == map.size;
+  }
+  if (valid) {
+    valid = valid_mesh_cache_payload(&header, map.data);
+  }
+  if (!valid) {
+    unmap_file(&map);
+    return false;
+  }
+
+  float* stream = (float*)(map.data + header.stream_offset);
+  mesh.vertices = (vec3_t*)(map.data + header.vertices_offset);
+  mesh.texcoords = (tex2_t*)(map.data + header.texcoords_offset);
+  mesh.faces = (face_t*)(map.data + header.faces_offset);
+  mesh.vertex_stream.x = stream;
+  mesh.vertex_stream.y = stream + header.stream_capacity;
+  mesh.vertex_stream.z = stream + 2 * header.stream_capacity;
+  mesh.vertex_stream.w = stream + 3 * header.stream_capacity;
+  mesh.vertex_stream.data = NULL;  // owned by the mapping
+  mesh.vertex_stream.capacity = (int)header.stream_capacity;
+  mesh_cache_map = map;
+  acmr[0] = header.acmr_before;
+  acmr[1] = header.acmr_after;
+  return true;
+}
+
+void save_mesh_cache(char* obj_filename, bool optimized, float acmr[2]) {
+  mesh_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MESH_CACHE_MAGIC, 8);
+  header.version = MESH_CACHE_VERSION;
+  header.vertex_size = sizeof(vec3_t);
+  header.texcoord_size = sizeof(tex2_t);
+  header.face_size = sizeof(face_t);
+  header.num_vertices = array_length(mesh.vertices);
+  header.num_faces = array_length(mesh.faces);
+  header.optimized = optimized;
+  header.acmr_before = acmr[0];
+  header.acmr_after = acmr[1];
+  layout_mesh_cache(&header);
+  if (array_length(mesh.texcoords) != (int)header.num_vertices ||
+      !get_file_info(obj_filename, &header.source_size,
+                     &header.source_mtime) ||
+      header.stream_capacity > (uint32_t)mesh.vertex_stream.capacity) {
+    return;
+  }
+
+  char filename[512];
+  get_mesh_cache_filename(obj_filename, filename, sizeof(filename));
+  FILE* file = fopen(filename, "wb");
+  if (!file) {
+    fprintf(stderr, "Error opening %s for writing.\n", filename);
+    return;
+  }
+
+  char vertices_header[ARRAY_HEADER_SIZE];
+  char faces_header[ARRAY_HEADER_SIZE];
+  array_write_header(vertices_header, header.num_vertices);  // texcoords too
+  array_write_header(faces_header, header.num_faces);
+  uint64_t vertices_size = sizeof(vec3_t) * (uint64_t)header.num_vertices;
+  uint64_t texcoords_size = sizeof(tex2_t) * (uint64_t)header.num_vertices;
+  uint64_t faces_size = sizeof(face_t) * (uint64_t)header.num_faces;
+  uint64_t stream_size = sizeof(float) * (uint64_t)header.stream_capacity;
+
+  uint64_t position = 0;
+  bool written =
+      write_mesh_cache_block(file, &position, 0, &header, sizeof(header)) &&
+      write_mesh_cache_block(file, &position,
+                             header.vertices_offset - ARRAY_HEADER_SIZE,
+                             vertices_header, ARRAY_HEADER_SIZE) &&
+      write_mesh_cache_block(file, &position, header.vertices_offset,
+                             mesh.vertices, vertices_size) &&
+      write_mesh_cache_block(file, &position,
+                             header.texcoords_offset - ARRAY_HEADER_SIZE,
+                             vertices_header, ARRAY_HEADER_SIZE) &&
+      write_mesh_cache_block(file, &position, header.texcoords_offset,
+                             mesh.texcoords, texcoords_size) &&
+      write_mesh_cache_block(file, &position,
+                             header.faces_offset - ARRAY_HEADER_SIZE,
+                             faces_header, ARRAY_HEADER_SIZE) &&
+      write_mesh_cache_block(file, &position, header.faces_offset, mesh.faces,
+                             faces_size) &&
+      write_mesh_cache_block(file, &position, header.stream_offset,
+                             mesh.vertex_stream.x, stream_size) &&
+      write_mesh_cache_block(file, &position, position, mesh.vertex_stream.y,
+                             stream_size) &&
+      write_mesh_cache_block(file, &position, position, mesh.vertex_stream.z,
+                             stream_size) &&
+      write_mesh_cache_block(file, &position, position, mesh.vertex_stream.w,
+                             stream_size);
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Error writing %s.\n", filename);
+    remove(filename);  // a partial cache would be rejected, but it is useless
+  }
+}
+
+// Free the arrays of the mesh, or unmap the cache they point into
+void free_mesh(void) {
+  if (mesh_cache_map.data) {
+    unmap_file(&mesh_cache_map);
+    mesh.vertex_stream.x = mesh.vertex_stream.y = NULL;
+    mesh.vertex_stream.z = mesh.vertex_stream.w = NULL;
+    mesh.vertex_stream.capacity = 0;
+  } else {
+    array_free(mesh.faces);
+    array_free(mesh.texcoords);
+    array_free(mesh.vertices);
+    vec4_soa_free(&mesh.vertex_stream);
+  }
+  mesh.faces = NULL;
+  mesh.texcoords = NULL;
+  mesh.vertices = NULL;
+}
@@ -8,15 +8,29 @@
 // declare vertices of the cube created from triangles
 extern vec3_t cube_vertices[N_CUBE_VERTICES];
 
+// Face as it is read from a model: the corners index the positions and carry
+// their own texture coordinates. Welding turns them into indexed faces.
+typedef struct {
+  int a;
+  int b;
+  int c;
+  tex2_t a_uv;
+  tex2_t b_uv;
+  tex2_t c_uv;
+  uint32_t color;
+} loaded_face_t;
+
 #define N_CUBE_FACES (6 * 2)  // 6 cube faces, 2 triangles per face
-extern face_t cube_faces[N_CUBE_FACES];
+extern loaded_face_t cube_faces[N_CUBE_FACES];
 
 typedef struct {
-  vec3_t *vertices;    // dynamic array of vertices
-  face_t *faces;       // dynamic array of faces
-  vec3_t rotation;     // rotation with x,y,z values - Euler angles
-  vec3_t scale;        // scale with x,y,z values
-  vec3_t translation;  // translation with x,y,z values
+  vec3_t *vertices;          // dynamic array of unique vertex positions
+  tex2_t *texcoords;         // texture coordinates of every vertex
+  vec4_soa_t vertex_stream;  // the vertices as aligned x/y/z arrays, w = 1
+  face_t *faces;             // dynamic array of indexed faces
+  vec3_t rotation;           // rotation with x,y,z values - Euler angles
+  vec3_t scale;              // scale with x,y,z values
+  vec3_t translation;        // translation with x,y,z values
 } mesh_t;
 
 // declare a global variable for mesh
@@ -24,5 +38,10 @@ extern mesh_t mesh;
 
 void load_cube_mesh_data(void);
 void load_obj_file_data(char *filename);
+void weld_mesh_faces(vec3_t *positions, loaded_face_t *faces, int num_faces);
+void update_vertex_stream(void);
+bool load_mesh_cache(char *obj_filename, bool optimized, float acmr[2]);
+void save_mesh_cache(char *obj_filename, bool optimized, float acmr[2]);
+void free_mesh(void);
 
 #endif
\ No newline at end of file
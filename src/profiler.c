@@ -0,0 +1,145 @@
+#include "profiler.h"
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display.h"
+#include "font.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame profiler
+///////////////////////////////////////////////////////////////////////////////
+//
+// Every stage is timed with the performance counter between profile_begin()
+// and profile_end(), a stage that runs several times in a frame adds up.
+// profile_end_frame() moves the times of the frame into a rolling history of
+// the last PROFILE_HISTORY frames, which the HUD shows as percentiles, and
+// optionally appends them to a CSV file as one row per frame.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool SHOW_PROFILE_HUD = false;
+
+char *profile_stage_names[PROFILE_NUM_STAGES] = {
+    "input", "geometry", "clear", "raster", "upload", "present", "frame"};
+
+uint64_t profile_stage_start[PROFILE_NUM_STAGES];
+uint64_t profile_stage_ticks[PROFILE_NUM_STAGES];
+
+// Milliseconds of every stage of the last frames, a ring buffer
+float profile_history[PROFILE_HISTORY][PROFILE_NUM_STAGES];
+int profile_history_count = 0;
+int profile_history_next = 0;
+
+int profile_frame = 0;
+FILE *profile_csv = NULL;
+
+void profile_begin(profile_stage_t stage) {
+  profile_stage_start[stage] = SDL_GetPerformanceCounter();
+}
+
+void profile_end(profile_stage_t stage) {
+  profile_stage_ticks[stage] +=
+      SDL_GetPerformanceCounter() - profile_stage_start[stage];
+}
+
+// Add the time of a stage that was measured on another thread
+void profile_add(profile_stage_t stage, uint64_t ticks) {
+  profile_stage_ticks[stage] += ticks;
+}
+
+void profile_end_frame(void) {
+  double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+  float *times = profile_history[profile_history_next];
+  float total = 0;
+  for (int i = 0; i < PROFILE_FRAME; i++) {
+    times[i] = profile_stage_ticks[i] * ms_per_tick;
+    total += times[i];
+    profile_stage_ticks[i] = 0;
+  }
+  times[PROFILE_FRAME] = total;
+
+  profile_history_next = (profile_history_next + 1) % PROFILE_HISTORY;
+  if (profile_history_count < PROFILE_HISTORY) profile_history_count++;
+
+  if (profile_csv) {
+    fprintf(profile_csv, "%d", profile_frame);
+    for (int i = 0; i < PROFILE_NUM_STAGES; i++) {
+      fprintf(profile_csv, ",%.4f", times[i]);
+    }
+    fprintf(profile_csv, "\n");
+  }
+  profile_frame++;
+}
+
+int compare_floats(const void *a, const void *b) {
+  float x = *(const float *)a;
+  float y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the times of a stage over the history
+float get_profile_percentile(profile_stage_t stage, float percentile) {
+  if (profile_history_count == 0) {
+    return 0;
+  }
+
+  float times[PROFILE_HISTORY];
+  for (int i = 0; i < profile_history_count; i++) {
+    times[i] = profile_history[i][stage];
+  }
+  qsort(times, profile_history_count, sizeof(float), compare_floats);
+
+  int rank = (int)(percentile / 100.0 * profile_history_count + 0.999);
+  if (rank < 1) rank = 1;
+  if (rank > profile_history_count) rank = profile_history_count;
+  return times[rank - 1];
+}
+
+bool open_profile_csv(char *filename) {
+  profile_csv = fopen(filename, "w");
+  if (!profile_csv) {
+    fprintf(stderr, "Error opening %s for writing.\n", filename);
+    return false;
+  }
+
+  fprintf(profile_csv, "frame");
+  for (int i = 0; i < PROFILE_NUM_STAGES; i++) {
+    fprintf(profile_csv, ",%s_ms", profile_stage_names[i]);
+  }
+  fprintf(profile_csv, "\n");
+  return true;
+}
+
+void close_profile_csv(void) {
+  if (profile_csv) {
+    fclose(profile_csv);
+    profile_csv = NULL;
+  }
+}
+
+// Draw a table of the p50, p95 and p99 times of every stage in milliseconds
+// over the top left corner of the color buffer
+void draw_profile_hud(void) {
+  int scale = 2;
+  int line_height = (FONT_HEIGHT + 3) * scale;
+  int margin = 4 * scale;
+  char line[64];
+
+  snprintf(line, sizeof(line), "%-9s%7s%7s%7s", "ms", "p50", "p95", "p99");
+  int width = get_text_width(line, scale) + 2 * margin;
+  int height = (PROFILE_NUM_STAGES + 1) * line_height + 2 * margin;
+  draw_rect(0, 0, width, height, 0xFF000000);
+
+  int x = margin;
+  int y = margin;
+  draw_text(x, y, line, scale, 0xFF00FFFF);
+  for (int i = 0; i < PROFILE_NUM_STAGES; i++) {
+    y += line_height;
+    snprintf(line, sizeof(line), "%-9s%7.2f%7.2f%7.2f", profile_stage_names[i],
+             get_profile_percentile(i, 50), get_profile_percentile(i, 95),
+             get_profile_percentile(i, 99));
+    draw_text(x, y, line, scale, 0xFFFFFFFF);
+  }
+}
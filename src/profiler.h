@@ -0,0 +1,33 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Stages of a frame timed by the profiler
+typedef enum {
+  PROFILE_INPUT,     // polling and handling SDL events
+  PROFILE_GEOMETRY,  // vertex transform, culling and projection
+  PROFILE_CLEAR,     // clearing the color and depth buffers
+  PROFILE_RASTER,    // drawing the triangles into the color buffer
+  PROFILE_UPLOAD,    // copying the color buffer into the SDL texture
+  PROFILE_PRESENT,   // presenting the frame, or writing it out when headless
+  PROFILE_FRAME,     // sum of all the stages
+  PROFILE_NUM_STAGES
+} profile_stage_t;
+
+// Number of frames the percentiles of the HUD are computed over
+#define PROFILE_HISTORY 240
+
+extern bool SHOW_PROFILE_HUD;
+
+void profile_begin(profile_stage_t stage);
+void profile_end(profile_stage_t stage);
+void profile_add(profile_stage_t stage, uint64_t ticks);
+void profile_end_frame(void);
+float get_profile_percentile(profile_stage_t stage, float percentile);
+bool open_profile_csv(char *filename);
+void close_profile_csv(void);
+void draw_profile_hud(void);
+
+#endif
@@ -0,0 +1,317 @@
+#include "span.h"
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "texture.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPAN_X86_SIMD
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Span kernels
+///////////////////////////////////////////////////////////////////////////////
+//
+// The kernels z-test and shade every pixel of a span. Besides the scalar
+// version there are SSE2 (4 pixels) and AVX2 (8 pixels) versions that compute
+// the depth and perspective correct UVs of several pixels at once and only
+// store the pixels that pass the z-test. The pixels at the end of the span
+// that do not fill a whole vector are handed over to the scalar kernel, so
+// no kernel ever touches a pixel outside of its span. Every kernel returns
+// the number of pixels that passed the z-test, for the pipeline statistics.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+int (*fill_span)(span_t* span, uint32_t color) = fill_span_scalar;
+int (*texture_span)(span_t* span, uint32_t* texture) = texture_span_scalar;
+char* span_kernel_name = "scalar";
+
+// Map an interpolated UV coordinate to the index of a texel
+int texel_index(float u, float v) {
+  int tex_x = abs((int)(u * texture_width)) % texture_width;
+  int tex_y = abs((int)(v * texture_height)) % texture_height;
+  return (texture_width * tex_y) + tex_x;
+}
+
+int fill_span_scalar(span_t* span, uint32_t color) {
+  float inv_w = span->inv_w;
+  int passed = 0;
+
+  for (int x = span->x_start; x <= span->x_end; x++) {
+    // Adjust 1/w so the pixels that are closer to the camera have smaller
+    // values, and only draw the pixel if it is closer than the one previously
+    // stored in the z-buffer
+    float depth = 1 - inv_w;
+    if (depth < span->depth[x]) {
+      span->color[x] = color;
+      span->depth[x] = depth;
+      passed++;
+    }
+    inv_w += span->inv_w_dx;
+  }
+  return passed;
+}
+
+int texture_span_scalar(span_t* span, uint32_t* texture) {
+  float inv_w = span->inv_w;
+  float u_w = span->u_w;
+  float v_w = span->v_w;
+  int passed = 0;
+
+  for (int x = span->x_start; x <= span->x_end; x++) {
+    float depth = 1 - inv_w;
+    if (depth < span->depth[x]) {
+      // Divide back u/w and v/w by 1/w to get the perspective correct UV
+      float w = 1 / inv_w;
+      span->color[x] = texture[texel_index(u_w * w, v_w * w)];
+      span->depth[x] = depth;
+      passed++;
+    }
+    inv_w += span->inv_w_dx;
+    u_w += span->u_w_dx;
+    v_w += span->v_w_dx;
+  }
+  return passed;
+}
+
+// Hand the pixels from x to the end of the span over to the scalar kernels
+void advance_span(span_t* tail, span_t* span, int x) {
+  int offset = x - span->x_start;
+  *tail = *span;
+  tail->x_start = x;
+  tail->inv_w += span->inv_w_dx * offset;
+  tail->u_w += span->u_w_dx * offset;
+  tail->v_w += span->v_w_dx * offset;
+}
+
+#ifdef SPAN_X86_SIMD
+
+__attribute__((target("sse2"))) int fill_span_sse2(span_t* span,
+                                                  uint32_t color) {
+  __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+  __m128 inv_w = _mm_add_ps(_mm_set1_ps(span->inv_w),
+                            _mm_mul_ps(lanes, _mm_set1_ps(span->inv_w_dx)));
+  __m128 inv_w_step = _mm_set1_ps(span->inv_w_dx * 4);
+  __m128 one = _mm_set1_ps(1);
+  __m128i colors = _mm_set1_epi32(color);
+  int passed = 0;
+
+  int x = span->x_start;
+  for (; x + 3 <= span->x_end; x += 4) {
+    __m128 depth = _mm_sub_ps(one, inv_w);
+    __m128 old_depth = _mm_loadu_ps(span->depth + x);
+    __m128 pass = _mm_cmplt_ps(depth, old_depth);
+    int pass_mask = _mm_movemask_ps(pass);
+
+    if (pass_mask) {
+      passed += __builtin_popcount(pass_mask);
+      _mm_storeu_ps(span->depth + x, _mm_or_ps(_mm_and_ps(pass, depth),
+                                               _mm_andnot_ps(pass, old_depth)));
+      // The color target may be the locked texture, which is slow to read,
+      // so the passing pixels are written without blending with it
+      if (pass_mask == 0xF) {
+        _mm_storeu_si128((__m128i*)(span->color + x), colors);
+      } else {
+        for (int i = 0; i < 4; i++) {
+          if (pass_mask & (1 << i)) span->color[x + i] = color;
+        }
+      }
+    }
+    inv_w = _mm_add_ps(inv_w, inv_w_step);
+  }
+
+  span_t tail;
+  advance_span(&tail, span, x);
+  return passed + fill_span_scalar(&tail, color);
+}
+
+__attribute__((target("sse2"))) int texture_span_sse2(span_t* span,
+                                                     uint32_t* texture) {
+  __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+  __m128 inv_w = _mm_add_ps(_mm_set1_ps(span->inv_w),
+                            _mm_mul_ps(lanes, _mm_set1_ps(span->inv_w_dx)));
+  __m128 u_w = _mm_add_ps(_mm_set1_ps(span->u_w),
+                          _mm_mul_ps(lanes, _mm_set1_ps(span->u_w_dx)));
+  __m128 v_w = _mm_add_ps(_mm_set1_ps(span->v_w),
+                          _mm_mul_ps(lanes, _mm_set1_ps(span->v_w_dx)));
+  __m128 inv_w_step = _mm_set1_ps(span->inv_w_dx * 4);
+  __m128 u_w_step = _mm_set1_ps(span->u_w_dx * 4);
+  __m128 v_w_step = _mm_set1_ps(span->v_w_dx * 4);
+  __m128 one = _mm_set1_ps(1);
+  __m128 tex_width = _mm_set1_ps(texture_width);
+  __m128 tex_height = _mm_set1_ps(texture_height);
+  int passed = 0;
+
+  int x = span->x_start;
+  for (; x + 3 <= span->x_end; x += 4) {
+    __m128 depth = _mm_sub_ps(one, inv_w);
+    __m128 old_depth = _mm_loadu_ps(span->depth + x);
+    __m128 pass = _mm_cmplt_ps(depth, old_depth);
+    int pass_mask = _mm_movemask_ps(pass);
+
+    if (pass_mask) {
+      passed += __builtin_popcount(pass_mask);
+
+      // Perspective correct UV of the four pixels, truncated to texels
+      __m128 w = _mm_div_ps(one, inv_w);
+      int tex_u[4], tex_v[4];
+      _mm_storeu_si128((__m128i*)tex_u,
+                       _mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(u_w, w), tex_width)));
+      _mm_storeu_si128((__m128i*)tex_v, _mm_cvttps_epi32(_mm_mul_ps(
+                                            _mm_mul_ps(v_w, w), tex_height)));
+
+      // SSE2 has no gather, fetch the texels of the passing pixels one by one
+      for (int i = 0; i < 4; i++) {
+        if (pass_mask & (1 << i)) {
+          int tex_x = abs(tex_u[i]) % texture_width;
+          int tex_y = abs(tex_v[i]) % texture_height;
+          span->color[x + i] = texture[(texture_width * tex_y) + tex_x];
+        }
+      }
+      _mm_storeu_ps(span->depth + x, _mm_or_ps(_mm_and_ps(pass, depth),
+                                               _mm_andnot_ps(pass, old_depth)));
+    }
+    inv_w = _mm_add_ps(inv_w, inv_w_step);
+    u_w = _mm_add_ps(u_w, u_w_step);
+    v_w = _mm_add_ps(v_w, v_w_step);
+  }
+
+  span_t tail;
+  advance_span(&tail, span, x);
+  return passed + texture_span_scalar(&tail, texture);
+}
+
+__attribute__((target("avx2"))) int fill_span_avx2(span_t* span,
+                                                  uint32_t color) {
+  __m256 lanes = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  __m256 inv_w = _mm256_add_ps(
+      _mm256_set1_ps(span->inv_w),
+      _mm256_mul_ps(lanes, _mm256_set1_ps(span->inv_w_dx)));
+  __m256 inv_w_step = _mm256_set1_ps(span->inv_w_dx * 8);
+  __m256 one = _mm256_set1_ps(1);
+  __m256i colors = _mm256_set1_epi32(color);
+  int passed = 0;
+
+  int x = span->x_start;
+  for (; x + 7 <= span->x_end; x += 8) {
+    __m256 depth = _mm256_sub_ps(one, inv_w);
+    __m256 old_depth = _mm256_loadu_ps(span->depth + x);
+    __m256 pass = _mm256_cmp_ps(depth, old_depth, _CMP_LT_OQ);
+    int pass_mask = _mm256_movemask_ps(pass);
+
+    if (pass_mask) {
+      passed += __builtin_popcount(pass_mask);
+      __m256i pass_i = _mm256_castps_si256(pass);
+      _mm256_maskstore_ps(span->depth + x, pass_i, depth);
+      _mm256_maskstore_epi32((int*)(span->color + x), pass_i, colors);
+    }
+    inv_w = _mm256_add_ps(inv_w, inv_w_step);
+  }
+
+  // Leave the AVX state clean before running non-AVX code again
+  _mm256_zeroupper();
+
+  span_t tail;
+  advance_span(&tail, span, x);
+  return passed + fill_span_scalar(&tail, color);
+}
+
+__attribute__((target("avx2"))) int texture_span_avx2(span_t* span,
+                                                     uint32_t* texture) {
+  __m256 lanes = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  __m256 inv_w = _mm256_add_ps(
+      _mm256_set1_ps(span->inv_w),
+      _mm256_mul_ps(lanes, _mm256_set1_ps(span->inv_w_dx)));
+  __m256 u_w = _mm256_add_ps(_mm256_set1_ps(span->u_w),
+                             _mm256_mul_ps(lanes, _mm256_set1_ps(span->u_w_dx)));
+  __m256 v_w = _mm256_add_ps(_mm256_set1_ps(span->v_w),
+                             _mm256_mul_ps(lanes, _mm256_set1_ps(span->v_w_dx)));
+  __m256 inv_w_step = _mm256_set1_ps(span->inv_w_dx * 8);
+  __m256 u_w_step = _mm256_set1_ps(span->u_w_dx * 8);
+  __m256 v_w_step = _mm256_set1_ps(span->v_w_dx * 8);
+  __m256 one = _mm256_set1_ps(1);
+  __m256 tex_width = _mm256_set1_ps(texture_width);
+  __m256 tex_height = _mm256_set1_ps(texture_height);
+
+  // With power of two texture sizes the modulo is a mask
+  bool pow2 = (texture_width & (texture_width - 1)) == 0 &&
+              (texture_height & (texture_height - 1)) == 0;
+  __m256i tex_x_mask = _mm256_set1_epi32(texture_width - 1);
+  __m256i tex_y_mask = _mm256_set1_epi32(texture_height - 1);
+  int passed = 0;
+
+  int x = span->x_start;
+  for (; x + 7 <= span->x_end; x += 8) {
+    __m256 depth = _mm256_sub_ps(one, inv_w);
+    __m256 old_depth = _mm256_loadu_ps(span->depth + x);
+    __m256 pass = _mm256_cmp_ps(depth, old_depth, _CMP_LT_OQ);
+    int pass_mask = _mm256_movemask_ps(pass);
+
+    if (pass_mask) {
+      passed += __builtin_popcount(pass_mask);
+
+      __m256 w = _mm256_div_ps(one, inv_w);
+      __m256i tex_x = _mm256_abs_epi32(
+          _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_mul_ps(u_w, w), tex_width)));
+      __m256i tex_y = _mm256_abs_epi32(_mm256_cvttps_epi32(
+          _mm256_mul_ps(_mm256_mul_ps(v_w, w), tex_height)));
+
+      if (pow2) {
+        tex_x = _mm256_and_si256(tex_x, tex_x_mask);
+        tex_y = _mm256_and_si256(tex_y, tex_y_mask);
+      }
+      int tex_u[8], tex_v[8];
+      _mm256_storeu_si256((__m256i*)tex_u, tex_x);
+      _mm256_storeu_si256((__m256i*)tex_v, tex_y);
+
+      // Fetch and store the texels of the passing pixels with scalar loads,
+      // hardware gathers are slower than that on many CPUs (and microcoded
+      // on recent Intel ones)
+      for (int i = 0; i < 8; i++) {
+        if (pass_mask & (1 << i)) {
+          int tex_x = pow2 ? tex_u[i] : tex_u[i] % texture_width;
+          int tex_y = pow2 ? tex_v[i] : tex_v[i] % texture_height;
+          span->color[x + i] = texture[(texture_width * tex_y) + tex_x];
+        }
+      }
+      _mm256_maskstore_ps(span->depth + x, _mm256_castps_si256(pass), depth);
+    }
+    inv_w = _mm256_add_ps(inv_w, inv_w_step);
+    u_w = _mm256_add_ps(u_w, u_w_step);
+    v_w = _mm256_add_ps(v_w, v_w_step);
+  }
+
+  // Leave the AVX state clean before running non-AVX code again
+  _mm256_zeroupper();
+
+  span_t tail;
+  advance_span(&tail, span, x);
+  return passed + texture_span_scalar(&tail, texture);
+}
+
+#endif
+
+// Select the widest kernels the CPU supports, or the ones named by name
+// ("scalar", "sse2" or "avx2") if the CPU supports them
+void initialize_span_kernels(char* name) {
+  fill_span = fill_span_scalar;
+  texture_span = texture_span_scalar;
+  span_kernel_name = "scalar";
+
+#ifdef SPAN_X86_SIMD
+  bool any = name == NULL;
+  if ((any || strcmp(name, "avx2") == 0) && SDL_HasAVX2()) {
+    fill_span = fill_span_avx2;
+    texture_span = texture_span_avx2;
+    span_kernel_name = "avx2";
+  } else if ((any || strcmp(name, "sse2") == 0) && SDL_HasSSE2()) {
+    fill_span = fill_span_sse2;
+    texture_span = texture_span_sse2;
+    span_kernel_name = "sse2";
+  }
+#endif
+}
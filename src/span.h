@@ -0,0 +1,31 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+
+// One horizontal run of pixels of a triangle, with the values of the
+// interpolated attributes at its first pixel and their steps per pixel
+typedef struct {
+  uint32_t* color;     // first pixel of the row in the color buffer
+  float* depth;        // first pixel of the row in the z-buffer
+  int x_start, x_end;  // first and last pixel of the span (inclusive)
+  float inv_w, inv_w_dx;
+  float u_w, u_w_dx;
+  float v_w, v_w_dx;
+} span_t;
+
+// Pixel kernels selected at runtime, they default to the scalar versions and
+// return the number of pixels that passed the z-test
+extern int (*fill_span)(span_t* span, uint32_t color);
+extern int (*texture_span)(span_t* span, uint32_t* texture);
+extern char* span_kernel_name;
+
+void initialize_span_kernels(char* name);
+
+int texel_index(float u, float v);
+void advance_span(span_t* tail, span_t* span, int x);
+
+int fill_span_scalar(span_t* span, uint32_t color);
+int texture_span_scalar(span_t* span, uint32_t* texture);
+
+#endif
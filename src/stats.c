@@ -0,0 +1,52 @@
+#include "stats.h"
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Pipeline statistics
+///////////////////////////////////////////////////////////////////////////////
+//
+// The stages count their work with count_pipeline_stat(). The rasterizer runs
+// on the tile workers, so the counters are atomic, and the hot loops sum their
+// counts locally and add them once per triangle. end_pipeline_stats_frame()
+// keeps the counts of the finished frame for get_pipeline_stat() and starts
+// counting the next one from zero. The number of z-test failures is the
+// difference between the pixels tested and passed.
+//
+///////////////////////////////////////////////////////////////////////////////
+char *pipeline_stat_names[STAT_NUM_COUNTERS] = {
+    "faces processed", "faces culled", "triangles emitted",
+    "triangles rasterized", "triangles rejected", "hiz rejections",
+    "pixels tested", "pixels passed", "pixels shaded", "texels fetched"};
+
+SDL_atomic_t pipeline_stat_counters[STAT_NUM_COUNTERS];
+int pipeline_stat_frame[STAT_NUM_COUNTERS];
+
+void count_pipeline_stat(pipeline_stat_t stat, int amount) {
+  if (amount != 0) {
+    SDL_AtomicAdd(&pipeline_stat_counters[stat], amount);
+  }
+}
+
+void end_pipeline_stats_frame(void) {
+  for (int i = 0; i < STAT_NUM_COUNTERS; i++) {
+    pipeline_stat_frame[i] = SDL_AtomicSet(&pipeline_stat_counters[i], 0);
+  }
+}
+
+// Value of a counter in the last finished frame
+int get_pipeline_stat(pipeline_stat_t stat) {
+  return pipeline_stat_frame[stat];
+}
+
+void print_pipeline_stats(void) {
+  for (int i = 0; i < STAT_NUM_COUNTERS; i++) {
+    printf("  %-22s %10d\n", pipeline_stat_names[i], pipeline_stat_frame[i]);
+  }
+
+  int tested = pipeline_stat_frame[STAT_PIXELS_TESTED];
+  int passed = pipeline_stat_frame[STAT_PIXELS_PASSED];
+  printf("  %-22s %10d (%.1f%% of the tested pixels)\n", "z-test failures",
+         tested - passed, tested ? 100.0 * (tested - passed) / tested : 0.0);
+}
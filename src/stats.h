@@ -0,0 +1,27 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Counters of the work done by the stages of the pipeline in a frame. They
+// are the same with or without tiles, except the HiZ rejections and so the
+// pixels tested: a triangle split into tiles is tested against the HiZ per
+// tile, which can reject a few more blocks.
+typedef enum {
+  STAT_FACES_PROCESSED,       // faces of the mesh sent through the geometry
+  STAT_FACES_CULLED,          // faces dropped by back-face culling
+  STAT_TRIANGLES_EMITTED,     // triangles queued for the rasterizer
+  STAT_TRIANGLES_RASTERIZED,  // emitted triangles with pixels on the screen
+  STAT_TRIANGLES_REJECTED,    // emitted triangles degenerate or off screen
+  STAT_HIZ_REJECTIONS,        // 8x8 blocks of triangles rejected by the HiZ
+  STAT_PIXELS_TESTED,         // pixels z-tested by the span kernels
+  STAT_PIXELS_PASSED,         // pixels that passed the z-test
+  STAT_PIXELS_SHADED,         // pixels of triangles written to the color buffer
+  STAT_TEXELS_FETCHED,        // texels read from the texture
+  STAT_NUM_COUNTERS
+} pipeline_stat_t;
+
+void count_pipeline_stat(pipeline_stat_t stat, int amount);
+void end_pipeline_stats_frame(void);
+int get_pipeline_stat(pipeline_stat_t stat);
+void print_pipeline_stats(void);
+
+#endif
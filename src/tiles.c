@@ -0,0 +1,184 @@
+#include "tiles.h"
+
+#include <SDL2/SDL.h>
+#include <math.h>
+
+#include "array.h"
+#include "display.h"
+#include "trace.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tile-binned (sort-middle) rasterizer
+///////////////////////////////////////////////////////////////////////////////
+//
+// The screen is split into TILE_SIZE x TILE_SIZE tiles. Every frame each
+// projected triangle is added to the bin of all the tiles its bounding box
+// overlaps, and then the tiles are rasterized by a pool of worker threads.
+// A tile only ever touches its own pixels of the color and z-buffer, so the
+// threads need no locks, and the triangles are drawn in submission order
+// within a tile, which gives the exact same image as the serial loop.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+int num_raster_threads = 0;
+
+int num_tiles_x = 0;
+int num_tiles_y = 0;
+int **tile_bins = NULL;  // for every tile, dynamic array of triangle indices
+
+SDL_Thread **tile_threads = NULL;
+SDL_sem *tiles_start = NULL;
+SDL_sem *tiles_done = NULL;
+SDL_atomic_t next_tile;
+bool tiles_quit = false;
+
+triangle_t *tile_triangles = NULL;
+
+// Rasterize tiles until there are none left for the current frame
+void rasterize_tiles(void) {
+  trace_begin("rasterize_tiles");
+  int num_tiles = num_tiles_x * num_tiles_y;
+
+  while (true) {
+    int tile = SDL_AtomicAdd(&next_tile, 1);
+    if (tile >= num_tiles) {
+      break;
+    }
+
+    int *bin = tile_bins[tile];
+    int num_binned = array_length(bin);
+    if (num_binned == 0) {
+      continue;
+    }
+
+    int tile_x = (tile % num_tiles_x) * TILE_SIZE;
+    int tile_y = (tile / num_tiles_x) * TILE_SIZE;
+    rect_t clip = {tile_x, tile_y, tile_x + TILE_SIZE - 1,
+                   tile_y + TILE_SIZE - 1};
+    if (clip.max_x > window_width - 1) clip.max_x = window_width - 1;
+    if (clip.max_y > window_height - 1) clip.max_y = window_height - 1;
+
+    if (USE_VISIBILITY_BUFFER) {
+      render_triangles_visibility(tile_triangles, bin, num_binned, clip);
+    } else {
+      for (int i = 0; i < num_binned; i++) {
+        render_triangle(&tile_triangles[bin[i]], clip);
+      }
+    }
+  }
+  trace_end();
+}
+
+int tile_worker(void *data) {
+  set_trace_thread_name("tile_worker");
+  while (true) {
+    SDL_SemWait(tiles_start);
+    if (tiles_quit) {
+      break;
+    }
+    rasterize_tiles();
+    SDL_SemPost(tiles_done);
+  }
+  return 0;
+}
+
+// Create the tile bins and num_threads - 1 worker threads, the calling thread
+// is the remaining one
+bool initialize_tiles(int num_threads) {
+  num_raster_threads = num_threads < 1 ? 1 : num_threads;
+  num_tiles_x = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+  num_tiles_y = (window_height + TILE_SIZE - 1) / TILE_SIZE;
+
+  tile_bins = (int **)calloc(num_tiles_x * num_tiles_y, sizeof(int *));
+  tiles_start = SDL_CreateSemaphore(0);
+  tiles_done = SDL_CreateSemaphore(0);
+  if (!tile_bins || !tiles_start || !tiles_done) {
+    fprintf(stderr, "Error creating the tile bins.\n");
+    return false;
+  }
+
+  tile_threads = (SDL_Thread **)calloc(num_raster_threads, sizeof(SDL_Thread *));
+  for (int i = 0; i < num_raster_threads - 1; i++) {
+    tile_threads[i] = SDL_CreateThread(tile_worker, "tile_worker", NULL);
+    if (!tile_threads[i]) {
+      fprintf(stderr, "Error creating tile worker thread.\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void render_tiles(triangle_t *triangles, int num_triangles) {
+  trace_begin("bin_triangles");
+  int num_tiles = num_tiles_x * num_tiles_y;
+  for (int i = 0; i < num_tiles; i++) {
+    array_reset(tile_bins[i]);
+  }
+
+  // Bin every triangle into all the tiles overlapped by its bounding box,
+  // grown by the size of the vertex points drawn with RENDER_VERTICES
+  float margin = 5.0;
+  for (int i = 0; i < num_triangles; i++) {
+    screen_point_t *points = triangles[i].points;
+    float min_x = fminf(points[0].x, fminf(points[1].x, points[2].x)) - margin;
+    float min_y = fminf(points[0].y, fminf(points[1].y, points[2].y)) - margin;
+    float max_x = fmaxf(points[0].x, fmaxf(points[1].x, points[2].x)) + margin;
+    float max_y = fmaxf(points[0].y, fmaxf(points[1].y, points[2].y)) + margin;
+    if (max_x < 0 || max_y < 0 || min_x >= window_width ||
+        min_y >= window_height) {
+      continue;
+    }
+
+    int first_x = min_x < 0 ? 0 : (int)min_x / TILE_SIZE;
+    int first_y = min_y < 0 ? 0 : (int)min_y / TILE_SIZE;
+    int last_x = max_x >= window_width ? num_tiles_x - 1 : (int)max_x / TILE_SIZE;
+    int last_y =
+        max_y >= window_height ? num_tiles_y - 1 : (int)max_y / TILE_SIZE;
+
+    for (int ty = first_y; ty <= last_y; ty++) {
+      for (int tx = first_x; tx <= last_x; tx++) {
+        array_push(tile_bins[ty * num_tiles_x + tx], i);
+      }
+    }
+  }
+
+  trace_end();
+
+  // Wake up the workers and rasterize tiles on this thread as well
+  tile_triangles = triangles;
+  SDL_AtomicSet(&next_tile, 0);
+  for (int i = 0; i < num_raster_threads - 1; i++) {
+    SDL_SemPost(tiles_start);
+  }
+  rasterize_tiles();
+  for (int i = 0; i < num_raster_threads - 1; i++) {
+    SDL_SemWait(tiles_done);
+  }
+}
+
+void destroy_tiles(void) {
+  if (tile_threads) {
+    tiles_quit = true;
+    for (int i = 0; i < num_raster_threads - 1; i++) {
+      SDL_SemPost(tiles_start);
+    }
+    for (int i = 0; i < num_raster_threads - 1; i++) {
+      SDL_WaitThread(tile_threads[i], NULL);
+    }
+    free(tile_threads);
+    tile_threads = NULL;
+  }
+
+  if (tile_bins) {
+    for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+      array_free(tile_bins[i]);
+    }
+    free(tile_bins);
+    tile_bins = NULL;
+  }
+
+  SDL_DestroySemaphore(tiles_start);
+  SDL_DestroySemaphore(tiles_done);
+  tiles_start = tiles_done = NULL;
+}
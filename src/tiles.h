@@ -0,0 +1,17 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdbool.h>
+
+#include "triangle.h"
+
+// Width and height in pixels of the screen tiles the triangles are binned into
+#define TILE_SIZE 64
+
+extern int num_raster_threads;
+
+bool initialize_tiles(int num_threads);
+void render_tiles(triangle_t *triangles, int num_triangles);
+void destroy_tiles(void);
+
+#endif
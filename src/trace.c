@@ -0,0 +1,189 @@
+#include "trace.h"
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Timeline tracing
+///////////////////////////////////////////////////////////////////////////////
+//
+// trace_begin() and trace_end() mark a scope on the calling thread. Scopes
+// nest, and when a scope ends it is stored as one complete event in a ring
+// buffer owned by the thread, so the threads never share a buffer and never
+// take a lock. A thread claims its buffer the first time it traces an event.
+// Only the last TRACE_BUFFER_EVENTS events of every thread are kept.
+//
+// close_trace() writes all the buffers as a Chrome trace (JSON), which
+// chrome://tracing and Perfetto show as a timeline with one lane per thread.
+// The names of the events must be string literals, they are only stored as
+// pointers. While tracing is off, the cost of an event is one branch.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool trace_enabled = false;
+
+typedef struct {
+  char *name;
+  uint64_t start;
+  uint64_t end;
+} trace_event_t;
+
+typedef struct {
+  char *name;             // name of the thread, NULL for the default one
+  trace_event_t *events;  // ring buffer of TRACE_BUFFER_EVENTS events
+  int num_events;         // number of events ever stored
+  trace_event_t open[TRACE_MAX_DEPTH];  // scopes that have not ended yet
+  int depth;
+} trace_thread_t;
+
+trace_thread_t trace_threads[TRACE_MAX_THREADS];
+SDL_atomic_t num_trace_threads;
+SDL_TLSID trace_thread_id = 0;
+
+char *trace_output_filename = NULL;
+uint64_t trace_start = 0;
+
+bool open_trace(char *filename) {
+  trace_thread_id = SDL_TLSCreate();
+  if (trace_thread_id == 0) {
+    fprintf(stderr, "Error creating the trace thread storage.\n");
+    return false;
+  }
+
+  trace_output_filename = filename;
+  trace_start = SDL_GetPerformanceCounter();
+  trace_enabled = true;
+  return true;
+}
+
+// Buffer of the calling thread, claimed on its first event. NULL when all
+// the buffers are taken.
+trace_thread_t *get_trace_thread(void) {
+  trace_thread_t *thread = (trace_thread_t *)SDL_TLSGet(trace_thread_id);
+  if (thread) {
+    return thread;
+  }
+
+  int index = SDL_AtomicAdd(&num_trace_threads, 1);
+  if (index >= TRACE_MAX_THREADS) {
+    return NULL;
+  }
+  thread = &trace_threads[index];
+  thread->events =
+      (trace_event_t *)malloc(sizeof(trace_event_t) * TRACE_BUFFER_EVENTS);
+  if (!thread->events) {
+    return NULL;
+  }
+  SDL_TLSSet(trace_thread_id, thread, NULL);
+  return thread;
+}
+
+// Name the lane of the calling thread in the trace
+void set_trace_thread_name(char *name) {
+  if (!trace_enabled) {
+    return;
+  }
+  trace_thread_t *thread = get_trace_thread();
+  if (thread) {
+    thread->name = name;
+  }
+}
+
+void trace_begin(char *name) {
+  if (!trace_enabled) {
+    return;
+  }
+  trace_thread_t *thread = get_trace_thread();
+  if (!thread) {
+    return;
+  }
+
+  // Scopes nested deeper than TRACE_MAX_DEPTH are only counted
+  if (thread->depth < TRACE_MAX_DEPTH) {
+    thread->open[thread->depth].name = name;
+    thread->open[thread->depth].start = SDL_GetPerformanceCounter();
+  }
+  thread->depth++;
+}
+
+void trace_end(void) {
+  if (!trace_enabled) {
+    return;
+  }
+  trace_thread_t *thread = get_trace_thread();
+  if (!thread || thread->depth == 0) {
+    return;
+  }
+
+  thread->depth--;
+  if (thread->depth < TRACE_MAX_DEPTH) {
+    trace_event_t *event =
+        &thread->events[thread->num_events % TRACE_BUFFER_EVENTS];
+    *event = thread->open[thread->depth];
+    event->end = SDL_GetPerformanceCounter();
+    thread->num_events++;
+  }
+}
+
+// Write the events of all the threads as a Chrome trace, with the times in
+// microseconds since open_trace()
+void write_trace(FILE *file, int num_threads) {
+  double us_per_tick = 1000000.0 / SDL_GetPerformanceFrequency();
+  char *separator = "";
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (int i = 0; i < num_threads; i++) {
+    trace_thread_t *thread = &trace_threads[i];
+    if (!thread->events) {
+      continue;
+    }
+
+    if (thread->name) {
+      fprintf(file,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}",
+              separator, i, thread->name);
+      separator = ",\n";
+    }
+
+    int count = thread->num_events < TRACE_BUFFER_EVENTS ? thread->num_events
+                                                         : TRACE_BUFFER_EVENTS;
+    for (int j = 0; j < count; j++) {
+      trace_event_t *event = &thread->events[j];
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              separator, event->name, i,
+              (event->start - trace_start) * us_per_tick,
+              (event->end - event->start) * us_per_tick);
+      separator = ",\n";
+    }
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+// Stop tracing, write the trace file and free the buffers. The other threads
+// must not be inside a traced scope anymore.
+void close_trace(void) {
+  if (!trace_enabled) {
+    return;
+  }
+  trace_enabled = false;
+
+  int num_threads = SDL_AtomicGet(&num_trace_threads);
+  if (num_threads > TRACE_MAX_THREADS) num_threads = TRACE_MAX_THREADS;
+
+  FILE *file = fopen(trace_output_filename, "w");
+  if (file) {
+    write_trace(file, num_threads);
+    fclose(file);
+  } else {
+    fprintf(stderr, "Error opening %s for writing.\n", trace_output_filename);
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    free(trace_threads[i].events);
+    trace_threads[i].events = NULL;
+  }
+}
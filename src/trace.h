@@ -0,0 +1,21 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+// Events of every thread kept for the trace, older ones are overwritten
+#define TRACE_BUFFER_EVENTS 16384
+
+// Maximum number of threads and of nested scopes per thread that are traced
+#define TRACE_MAX_THREADS 64
+#define TRACE_MAX_DEPTH 16
+
+extern bool trace_enabled;
+
+bool open_trace(char *filename);
+void close_trace(void);
+void set_trace_thread_name(char *name);
+void trace_begin(char *name);
+void trace_end(void);
+
+#endif
@@ -1,6 +1,10 @@
 #include "triangle.h"
 
+#include <math.h>
+
 #include "display.h"
+#include "span.h"
+#include "stats.h"
 #include "swap.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -8,9 +12,14 @@
 ///////////////////////////////////////////////////////////////////////////////
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
                    uint32_t color) {
-  draw_line(x0, y0, x1, y1, color);
-  draw_line(x1, y1, x2, y2, color);
-  draw_line(x2, y2, x0, y0, color);
+  draw_triangle_clipped(x0, y0, x1, y1, x2, y2, color, screen_rect());
+}
+
+void draw_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2,
+                           uint32_t color, rect_t clip) {
+  draw_line_clipped(x0, y0, x1, y1, color, clip);
+  draw_line_clipped(x1, y1, x2, y2, color, clip);
+  draw_line_clipped(x2, y2, x0, y0, color, clip);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -76,280 +85,470 @@ void fill_flat_top_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Draw a filled triangle with the flat-top/flat-bottom method
-// We split the original triangle in two, half flat-bottom and half flat-top
+// Fixed-point subpixel precision of the rasterizer
 ///////////////////////////////////////////////////////////////////////////////
 //
-//          (x0,y0)
-//            / \
-//           /   \
-//          /     \
-//         /       \
-//        /         \
-//   (x1,y1)------(Mx,My)
-//       \_           \
-//          \_         \
-//             \_       \
-//                \_     \
-//                   \    \
-//                     \_  \
-//                        \_\
-//                           \
-//                         (x2,y2)
+// Vertices are snapped to 28.4 fixed point (1/16 of a pixel) before the edge
+// functions are set up, so all the coverage math is exact integer math and
+// the result does not depend on the order or the position of the triangle.
+// Vertices outside of the guard band are the result of projecting points
+// that are behind the camera, those triangles are not rasterized.
 //
 ///////////////////////////////////////////////////////////////////////////////
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1,
-                          float z1, float w1, int x2, int y2, float z2,
-                          float w2, uint32_t color) {
-  // // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
-  // if (y0 > y1) {
-  //   int_swap(&y0, &y1);
-  //   int_swap(&x0, &x1);
-  // }
-  // if (y1 > y2) {
-  //   int_swap(&y1, &y2);
-  //   int_swap(&x1, &x2);
-  // }
-  // if (y0 > y1) {
-  //   int_swap(&y0, &y1);
-  //   int_swap(&x0, &x1);
-  // }
-
-  // if (y1 == y2) {
-  //   // Draw flat-bottom triangle
-  //   fill_flat_bottom_triangle(x0, y0, x1, y1, x2, y2, color);
-  // } else if (y0 == y1) {
-  //   // Draw flat-top triangle
-  //   fill_flat_top_triangle(x0, y0, x1, y1, x2, y2, color);
-  // } else {
-  //   // Calculate the new vertex (Mx,My) using triangle similarity
-  //   int My = y1;
-  //   int Mx = (((x2 - x0) * (y1 - y0)) / (y2 - y0)) + x0;
-
-  //   // Draw flat-bottom triangle
-  //   fill_flat_bottom_triangle(x0, y0, x1, y1, Mx, My, color);
-
-  //   // Draw flat-top triangle
-  //   fill_flat_top_triangle(x1, y1, Mx, My, x2, y2, color);
-  // }
-
-  // ------------------------------- Z-BUFFER
-
-  // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
-  if (y0 > y1) {
-    int_swap(&y0, &y1);
-    int_swap(&x0, &x1);
-    float_swap(&z0, &z1);
-    float_swap(&w0, &w1);
-  }
-  if (y1 > y2) {
-    int_swap(&y1, &y2);
-    int_swap(&x1, &x2);
-    float_swap(&z1, &z2);
-    float_swap(&w1, &w2);
-  }
-  if (y0 > y1) {
-    int_swap(&y0, &y1);
-    int_swap(&x0, &x1);
-    float_swap(&z0, &z1);
-    float_swap(&w0, &w1);
-  }
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define GUARD_BAND 1048576.0
 
-  // Create three vector points after we sort the vertices
-  vec4_t point_a = {x0, y0, z0, w0};
-  vec4_t point_b = {x1, y1, z1, w1};
-  vec4_t point_c = {x2, y2, z2, w2};
-
-  ///////////////////////////////////////////////////////
-  // Render the upper part of the triangle (flat-bottom)
-  ///////////////////////////////////////////////////////
-  float inv_slope_1 = 0;
-  float inv_slope_2 = 0;
+///////////////////////////////////////////////////////////////////////////////
+// Edge function of the edge (a,b) evaluated at point p
+///////////////////////////////////////////////////////////////////////////////
+//
+// It returns twice the signed area of the triangle (a,b,p). The sign tells on
+// which side of the edge the point is, and divided by the full triangle area
+// it is the barycentric weight of the vertex opposite to the edge.
+//
+///////////////////////////////////////////////////////////////////////////////
+int64_t edge_function(int64_t ax, int64_t ay, int64_t bx, int64_t by,
+                      int64_t px, int64_t py) {
+  return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
 
-  if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-  if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+///////////////////////////////////////////////////////////////////////////////
+// Per-triangle setup of the half-space rasterizer
+///////////////////////////////////////////////////////////////////////////////
+//
+// All the work that does not depend on the pixel is done once per triangle:
+// the three edge functions and the screen-space gradients of 1/w, u/w and v/w
+// (which are linear in screen space). The rasterizer then walks the bounding
+// box and only adds the x/y steps to get the values of the next row or pixel.
+// Pixels are sampled at their centers.
+//
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+  int min_x, min_y, max_x, max_y;  // clipped bounding box
+  int64_t edge[3];                 // edge functions at (min_x, min_y)
+  int64_t edge_dx[3], edge_dy[3];  // edge function steps in x and y
+  float inv_w, inv_w_dx, inv_w_dy;  // 1/w at (min_x, min_y) and gradients
+  float u_w, u_w_dx, u_w_dy;        // u/w at (min_x, min_y) and gradients
+  float v_w, v_w_dx, v_w_dy;        // v/w at (min_x, min_y) and gradients
+  uint32_t* target;                 // buffer the spans write their color to
+  int target_pitch;                 // pixels per row of the target
+  int pixels_tested, pixels_passed;  // pipeline statistics of the triangle
+  int hiz_rejections;
+} triangle_setup_t;
+
+// Compute the gradient of an attribute with the values f0, f1, f2 at the three
+// vertices and return its value at (x,y)
+float setup_attribute(float x0, float y0, float x1, float y1, float x2,
+                      float y2, float area, float f0, float f1, float f2,
+                      float x, float y, float* dx, float* dy) {
+  *dx = ((f1 - f0) * (y2 - y0) - (f2 - f0) * (y1 - y0)) / area;
+  *dy = ((f2 - f0) * (x1 - x0) - (f1 - f0) * (x2 - x0)) / area;
+  return f0 + *dx * (x - x0) + *dy * (y - y0);
+}
 
-  if (y1 - y0 != 0) {
-    for (int y = y0; y <= y1; y++) {
-      int x_start = x1 + (y - y1) * inv_slope_1;
-      int x_end = x0 + (y - y0) * inv_slope_2;
+// Top-left fill rule: a pixel center that lies exactly on an edge belongs to
+// the triangle only if the edge is a top edge (horizontal, with the triangle
+// below it) or a left edge. Shared edges are then drawn by exactly one of the
+// two triangles. With the winding used by setup_triangle (y grows downwards)
+// top edges go to the right and left edges go up.
+bool is_top_left_edge(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+  return (ay == by && bx > ax) || by < ay;
+}
 
-      if (x_end < x_start) {
-        int_swap(&x_start, &x_end);  // swap if x_start is to the right of x_end
-      }
+bool setup_triangle(triangle_setup_t* setup, float x0, float y0, float w0,
+                    float u0, float v0, float x1, float y1, float w1, float u1,
+                    float v1, float x2, float y2, float w2, float u2, float v2,
+                    rect_t clip) {
+  if (!(fabsf(x0) < GUARD_BAND && fabsf(y0) < GUARD_BAND &&
+        fabsf(x1) < GUARD_BAND && fabsf(y1) < GUARD_BAND &&
+        fabsf(x2) < GUARD_BAND && fabsf(y2) < GUARD_BAND)) {
+    return false;
+  }
 
-      for (int x = x_start; x < x_end; x++) {
-        // Draw our pixel with a solid color
-        draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
-      }
-    }
+  // Snap the vertices to the subpixel grid
+  int64_t fx0 = llrintf(x0 * SUBPIXEL_ONE);
+  int64_t fy0 = llrintf(y0 * SUBPIXEL_ONE);
+  int64_t fx1 = llrintf(x1 * SUBPIXEL_ONE);
+  int64_t fy1 = llrintf(y1 * SUBPIXEL_ONE);
+  int64_t fx2 = llrintf(x2 * SUBPIXEL_ONE);
+  int64_t fy2 = llrintf(y2 * SUBPIXEL_ONE);
+
+  int64_t area = edge_function(fx0, fy0, fx1, fy1, fx2, fy2);
+  if (area == 0) {
+    return false;  // degenerate triangle, nothing to draw
   }
 
-  ///////////////////////////////////////////////////////
-  // Render the bottom part of the triangle (flat-top)
-  ///////////////////////////////////////////////////////
-  inv_slope_1 = 0;
-  inv_slope_2 = 0;
+  // Swap vertices b and c of triangles with the other winding, so the inside
+  // of the triangle is always where all three edge functions are positive
+  if (area < 0) {
+    int64_t tmp_x = fx1, tmp_y = fy1;
+    fx1 = fx2, fy1 = fy2;
+    fx2 = tmp_x, fy2 = tmp_y;
+    float_swap(&w1, &w2);
+    float_swap(&u1, &u2);
+    float_swap(&v1, &v2);
+    area = -area;
+  }
 
-  if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-  if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+  // Find the bounding box of the triangle and clip it to the clip rectangle
+  int64_t min_fx = fx0 < fx1 ? (fx0 < fx2 ? fx0 : fx2) : (fx1 < fx2 ? fx1 : fx2);
+  int64_t min_fy = fy0 < fy1 ? (fy0 < fy2 ? fy0 : fy2) : (fy1 < fy2 ? fy1 : fy2);
+  int64_t max_fx = fx0 > fx1 ? (fx0 > fx2 ? fx0 : fx2) : (fx1 > fx2 ? fx1 : fx2);
+  int64_t max_fy = fy0 > fy1 ? (fy0 > fy2 ? fy0 : fy2) : (fy1 > fy2 ? fy1 : fy2);
+  setup->min_x = min_fx < clip.min_x * SUBPIXEL_ONE ? clip.min_x
+                                                    : min_fx >> SUBPIXEL_BITS;
+  setup->min_y = min_fy < clip.min_y * SUBPIXEL_ONE ? clip.min_y
+                                                    : min_fy >> SUBPIXEL_BITS;
+  setup->max_x = max_fx > clip.max_x * SUBPIXEL_ONE ? clip.max_x
+                                                    : max_fx >> SUBPIXEL_BITS;
+  setup->max_y = max_fy > clip.max_y * SUBPIXEL_ONE ? clip.max_y
+                                                    : max_fy >> SUBPIXEL_BITS;
+  if (setup->min_x > setup->max_x || setup->min_y > setup->max_y) {
+    return false;  // the triangle is completely outside of the clip rectangle
+  }
 
-  if (y2 - y1 != 0) {
-    for (int y = y1; y <= y2; y++) {
-      int x_start = x1 + (y - y1) * inv_slope_1;
-      int x_end = x0 + (y - y0) * inv_slope_2;
+  // Center of the first pixel of the bounding box in fixed point
+  int64_t px = ((int64_t)setup->min_x << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+  int64_t py = ((int64_t)setup->min_y << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+
+  // Edge (b,c) gives the weight of vertex a, (c,a) of b and (a,b) of c.
+  // Pixels exactly on an edge that is not top-left are biased to the outside.
+  setup->edge[0] = edge_function(fx1, fy1, fx2, fy2, px, py) -
+                   !is_top_left_edge(fx1, fy1, fx2, fy2);
+  setup->edge[1] = edge_function(fx2, fy2, fx0, fy0, px, py) -
+                   !is_top_left_edge(fx2, fy2, fx0, fy0);
+  setup->edge[2] = edge_function(fx0, fy0, fx1, fy1, px, py) -
+                   !is_top_left_edge(fx0, fy0, fx1, fy1);
+  setup->edge_dx[0] = (fy1 - fy2) * SUBPIXEL_ONE;
+  setup->edge_dx[1] = (fy2 - fy0) * SUBPIXEL_ONE;
+  setup->edge_dx[2] = (fy0 - fy1) * SUBPIXEL_ONE;
+  setup->edge_dy[0] = (fx2 - fx1) * SUBPIXEL_ONE;
+  setup->edge_dy[1] = (fx0 - fx2) * SUBPIXEL_ONE;
+  setup->edge_dy[2] = (fx1 - fx0) * SUBPIXEL_ONE;
+
+  // 1/w, u/w and v/w are linear in screen space, so they can be stepped.
+  // They are set up from the snapped vertices to match the coverage.
+  float sx0 = fx0 / (float)SUBPIXEL_ONE, sy0 = fy0 / (float)SUBPIXEL_ONE;
+  float sx1 = fx1 / (float)SUBPIXEL_ONE, sy1 = fy1 / (float)SUBPIXEL_ONE;
+  float sx2 = fx2 / (float)SUBPIXEL_ONE, sy2 = fy2 / (float)SUBPIXEL_ONE;
+  float farea = area / (float)(SUBPIXEL_ONE * SUBPIXEL_ONE);
+  float cx = setup->min_x + 0.5;
+  float cy = setup->min_y + 0.5;
+
+  setup->inv_w = setup_attribute(sx0, sy0, sx1, sy1, sx2, sy2, farea, 1 / w0,
+                                 1 / w1, 1 / w2, cx, cy, &setup->inv_w_dx,
+                                 &setup->inv_w_dy);
+  setup->u_w = setup_attribute(sx0, sy0, sx1, sy1, sx2, sy2, farea, u0 / w0,
+                               u1 / w1, u2 / w2, cx, cy, &setup->u_w_dx,
+                               &setup->u_w_dy);
+  setup->v_w = setup_attribute(sx0, sy0, sx1, sy1, sx2, sy2, farea, v0 / w0,
+                               v1 / w1, v2 / w2, cx, cy, &setup->v_w_dx,
+                               &setup->v_w_dy);
+  setup->target = framebuffer.pixels;
+  setup->target_pitch = framebuffer.pitch;
+  setup->pixels_tested = 0;
+  setup->pixels_passed = 0;
+  setup->hiz_rejections = 0;
+
+  return true;
+}
 
-      if (x_end < x_start) {
-        int_swap(&x_start, &x_end);  // swap if x_start is to the right of x_end
-      }
+// Integer division rounding towards negative infinity (b > 0)
+int64_t floor_div(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
 
-      for (int x = x_start; x < x_end; x++) {
-        // Draw our pixel with a solid color
-        draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
-      }
+///////////////////////////////////////////////////////////////////////////////
+// Find the span of row y that is inside the triangle
+///////////////////////////////////////////////////////////////////////////////
+//
+// Along the row every edge function is linear in x, so instead of testing
+// every pixel we solve for the x where each edge crosses zero. Edges with a
+// positive x step bound the span on the left and the ones with a negative
+// step bound it on the right. The solve is exact integer math, so it gives
+// the same pixels as testing each one. The attributes are evaluated at the
+// first pixel of the span, the span kernels step them from there.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool setup_span(triangle_setup_t* setup, int y, span_t* span) {
+  int64_t row = y - setup->min_y;
+  int64_t first = 0;
+  int64_t last = setup->max_x - setup->min_x;
+
+  for (int i = 0; i < 3; i++) {
+    int64_t edge = setup->edge[i] + setup->edge_dy[i] * row;
+    int64_t edge_dx = setup->edge_dx[i];
+    if (edge_dx > 0) {
+      // edge + edge_dx * t >= 0  <=>  t >= ceil(-edge / edge_dx)
+      int64_t t = -floor_div(edge, edge_dx);
+      if (t > first) first = t;
+    } else if (edge_dx < 0) {
+      // edge + edge_dx * t >= 0  <=>  t <= floor(edge / -edge_dx)
+      int64_t t = floor_div(edge, -edge_dx);
+      if (t < last) last = t;
+    } else if (edge < 0) {
+      return false;  // the row is outside of a horizontal edge
     }
   }
+  if (first > last) {
+    return false;
+  }
+
+  span->x_start = setup->min_x + (int)first;
+  span->x_end = setup->min_x + (int)last;
+  span->color = setup->target + setup->target_pitch * y;
+  span->depth = z_buffer + window_width * y;
+  span->inv_w = setup->inv_w + setup->inv_w_dx * first + setup->inv_w_dy * row;
+  span->inv_w_dx = setup->inv_w_dx;
+  span->u_w = setup->u_w + setup->u_w_dx * first + setup->u_w_dy * row;
+  span->u_w_dx = setup->u_w_dx;
+  span->v_w = setup->v_w + setup->v_w_dx * first + setup->v_w_dy * row;
+  span->v_w_dx = setup->v_w_dx;
+
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Return the barycentric weights alpha, beta, and gamma for point p
+// Rasterize a triangle in blocks of the hierarchical z-buffer
 ///////////////////////////////////////////////////////////////////////////////
 //
-//         (B)
-//         /|\
-//        / | \
-//       /  |  \
-//      /  (P)  \
-//     /  /   \  \
-//    / /       \ \
-//   //           \\
-//  (A)------------(C)
+// The spans of HIZ_BLOCK_SIZE rows are set up together and tested against
+// the hierarchical z-buffer block by block. The plane of 1/w gives the closest
+// depth the triangle can have inside a block, and if that is not closer than
+// the farthest depth already stored in the block, the whole block is rejected
+// before any of its pixels is shaded. Runs of blocks that pass are drawn with
+// one call to the span kernel per row. When the triangle covers a whole block,
+// its farthest depth inside the block becomes the new bound of the block.
+//
+// Depths only ever get closer, so the bound of a dirty block is still safe to
+// test against, just not as tight. Recomputing it reads the whole block, which
+// only pays off for triangles that are big enough to touch many blocks. Small
+// triangles are tested once against all the blocks of their bounding box and
+// then drawn row by row, the per-block work would cost more than it saves.
+//
+// The spans are filled with the color, or textured if texture is not NULL.
 //
 ///////////////////////////////////////////////////////////////////////////////
-vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
-  // Find the vectors between the vertices ABC and point p
-  vec2_t ac = vec2_sub(c, a);
-  vec2_t ab = vec2_sub(b, a);
-  vec2_t ap = vec2_sub(p, a);
-  vec2_t pc = vec2_sub(c, p);
-  vec2_t pb = vec2_sub(b, p);
-
-  // Compute the area of the full parallegram/triangle ABC using 2D cross
-  // product
-  float area_parallelogram_abc = (ac.x * ab.y - ac.y * ab.x);  // || AC x AB ||
-
-  // Alpha is the area of the small parallelogram/triangle PBC divided by the
-  // area of the full parallelogram/triangle ABC
-  float alpha = (pc.x * pb.y - pc.y * pb.x) / area_parallelogram_abc;
+#define HIZ_LARGE_TRIANGLE_AREA (4 * HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE)
+
+void draw_span(triangle_setup_t* setup, span_t* span, uint32_t color,
+               uint32_t* texture) {
+  setup->pixels_tested += span->x_end - span->x_start + 1;
+  if (texture) {
+    setup->pixels_passed += texture_span(span, texture);
+  } else {
+    setup->pixels_passed += fill_span(span, color);
+  }
+}
 
-  // Beta is the area of the small parallelogram/triangle APC divided by the
-  // area of the full parallelogram/triangle ABC
-  float beta = (ac.x * ap.y - ac.y * ap.x) / area_parallelogram_abc;
+// Add the work done drawing a triangle to the pipeline statistics
+void count_triangle_stats(triangle_setup_t* setup, uint32_t* texture) {
+  count_pipeline_stat(STAT_HIZ_REJECTIONS, setup->hiz_rejections);
+  count_pipeline_stat(STAT_PIXELS_TESTED, setup->pixels_tested);
+  count_pipeline_stat(STAT_PIXELS_PASSED, setup->pixels_passed);
+  if (setup->target == framebuffer.pixels) {
+    count_pipeline_stat(STAT_PIXELS_SHADED, setup->pixels_passed);
+  }
+  if (texture) {
+    count_pipeline_stat(STAT_TEXELS_FETCHED, setup->pixels_passed);
+  }
+}
 
-  // Weight gamma is easily found since barycentric coordinates always add up
-  // to 1.0
-  float gamma = 1 - alpha - beta;
+void draw_spans_run(triangle_setup_t* setup, span_t* spans, bool* has_span,
+                    int num_rows, int x_start, int x_end, uint32_t color,
+                    uint32_t* texture) {
+  for (int row = 0; row < num_rows; row++) {
+    span_t* span = &spans[row];
+    if (!has_span[row] || span->x_end < x_start || span->x_start > x_end) {
+      continue;
+    }
 
-  vec3_t weights = {alpha, beta, gamma};
-  return weights;
+    // Draw the part of the span that is inside the run of blocks
+    span_t run_span;
+    advance_span(&run_span, span,
+                 span->x_start > x_start ? span->x_start : x_start);
+    if (run_span.x_end > x_end) run_span.x_end = x_end;
+    draw_span(setup, &run_span, color, texture);
+  }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Function to draw a solid pixel at position (x,y) using depth interpolation
-///////////////////////////////////////////////////////////////////////////////
-void draw_triangle_pixel(int x, int y, uint32_t color, vec4_t point_a,
-                         vec4_t point_b, vec4_t point_c) {
-  // Create three vec2 to find the interpolation
-  vec2_t p = {x, y};
-  vec2_t a = vec2_from_vec4(point_a);
-  vec2_t b = vec2_from_vec4(point_b);
-  vec2_t c = vec2_from_vec4(point_c);
+void rasterize_small_triangle(triangle_setup_t* setup, uint32_t color,
+                              uint32_t* texture) {
+  int first_block_x = setup->min_x / HIZ_BLOCK_SIZE;
+  int first_block_y = setup->min_y / HIZ_BLOCK_SIZE;
+  int last_block_x = setup->max_x / HIZ_BLOCK_SIZE;
+  int last_block_y = setup->max_y / HIZ_BLOCK_SIZE;
+
+  // Closest depth of the triangle anywhere in its bounding box
+  float inv_w_x = setup->inv_w_dx * (setup->max_x - setup->min_x);
+  float inv_w_y = setup->inv_w_dy * (setup->max_y - setup->min_y);
+  float min_depth = 1 - (setup->inv_w + fmaxf(inv_w_x, 0) + fmaxf(inv_w_y, 0));
+
+  bool visible = false;
+  for (int block_y = first_block_y; block_y <= last_block_y; block_y++) {
+    for (int block_x = first_block_x; block_x <= last_block_x; block_x++) {
+      prepare_hiz_block(block_x, block_y);
+      if (min_depth < hiz_buffer[hiz_width * block_y + block_x]) {
+        visible = true;
+      }
+    }
+  }
+  if (!visible) {
+    setup->hiz_rejections += (last_block_x - first_block_x + 1) *
+                             (last_block_y - first_block_y + 1);
+    return;  // the triangle is behind everything in its bounding box
+  }
 
-  // Calculate the barycentric coordinates of our point 'p' inside the triangle
-  vec3_t weights = barycentric_weights(a, b, c, p);
+  for (int y = setup->min_y; y <= setup->max_y; y++) {
+    span_t span;
+    if (setup_span(setup, y, &span)) {
+      draw_span(setup, &span, color, texture);
+    }
+  }
 
-  float alpha = weights.x;
-  float beta = weights.y;
-  float gamma = weights.z;
+  for (int block_y = first_block_y; block_y <= last_block_y; block_y++) {
+    for (int block_x = first_block_x; block_x <= last_block_x; block_x++) {
+      hiz_dirty[hiz_width * block_y + block_x] = 1;
+    }
+  }
+}
 
-  // Interpolate the value of 1/w for the current pixel
-  float interpolated_reciprocal_w = (1 / point_a.w) * alpha +
-                                    (1 / point_b.w) * beta +
-                                    (1 / point_c.w) * gamma;
+void rasterize_triangle(triangle_setup_t* setup, uint32_t color,
+                        uint32_t* texture) {
+  if ((setup->max_x - setup->min_x + 1) * (setup->max_y - setup->min_y + 1) <
+      HIZ_LARGE_TRIANGLE_AREA) {
+    rasterize_small_triangle(setup, color, texture);
+    count_triangle_stats(setup, texture);
+    return;
+  }
 
-  // Adjust 1/w so the pixels that are closer to the camera have smaller values
-  interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+  int first_block_y = setup->min_y / HIZ_BLOCK_SIZE;
+  int last_block_y = setup->max_y / HIZ_BLOCK_SIZE;
+
+  for (int block_y = first_block_y; block_y <= last_block_y; block_y++) {
+    int block_y_start = block_y * HIZ_BLOCK_SIZE;
+    int block_y_end = block_y_start + HIZ_BLOCK_SIZE - 1;
+    if (block_y_end > window_height - 1) block_y_end = window_height - 1;
+    int y_start = block_y_start > setup->min_y ? block_y_start : setup->min_y;
+    int y_end = block_y_end < setup->max_y ? block_y_end : setup->max_y;
+    int num_rows = y_end - y_start + 1;
+
+    // Set up the spans of all the rows of this row of blocks
+    span_t spans[HIZ_BLOCK_SIZE];
+    bool has_span[HIZ_BLOCK_SIZE];
+    int min_x = setup->max_x + 1;
+    int max_x = setup->min_x - 1;
+    for (int row = 0; row < num_rows; row++) {
+      span_t* span = &spans[row];
+      has_span[row] = setup_span(setup, y_start + row, span);
+      if (has_span[row]) {
+        if (span->x_start < min_x) min_x = span->x_start;
+        if (span->x_end > max_x) max_x = span->x_end;
+      }
+    }
+    if (min_x > max_x) {
+      continue;
+    }
 
-  // Only draw the pixel if the depth value is less than the one previously
-  // stored in the z-buffer
-  if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
-    // Draw a pixel at position (x,y) with a solid color
-    draw_pixel(x, y, color);
+    int run_start = -1;
+    for (int block_x = min_x / HIZ_BLOCK_SIZE;
+         block_x <= max_x / HIZ_BLOCK_SIZE; block_x++) {
+      int block_x_start = block_x * HIZ_BLOCK_SIZE;
+      int block_x_end = block_x_start + HIZ_BLOCK_SIZE - 1;
+      if (block_x_end > window_width - 1) block_x_end = window_width - 1;
+      int x_start = block_x_start > min_x ? block_x_start : min_x;
+      int x_end = block_x_end < max_x ? block_x_end : max_x;
+
+      // 1/w is linear, so its extremes over the part of the block covered by
+      // the spans are at the corners of that rectangle
+      float inv_w = setup->inv_w + setup->inv_w_dx * (x_start - setup->min_x) +
+                    setup->inv_w_dy * (y_start - setup->min_y);
+      float inv_w_x = setup->inv_w_dx * (x_end - x_start);
+      float inv_w_y = setup->inv_w_dy * (y_end - y_start);
+      float max_inv_w = inv_w + fmaxf(inv_w_x, 0) + fmaxf(inv_w_y, 0);
+      float min_inv_w = inv_w + fminf(inv_w_x, 0) + fminf(inv_w_y, 0);
+      float min_depth = 1 - max_inv_w;
+
+      int block = hiz_width * block_y + block_x;
+      prepare_hiz_block(block_x, block_y);
+      if (hiz_dirty[block] && min_depth < hiz_buffer[block]) {
+        update_hiz_block(block_x, block_y);
+      }
+      if (min_depth >= hiz_buffer[block]) {
+        // The triangle is behind everything in this block
+        setup->hiz_rejections++;
+        if (run_start >= 0) {
+          draw_spans_run(setup, spans, has_span, num_rows, run_start,
+                         block_x_start - 1, color, texture);
+          run_start = -1;
+        }
+        continue;
+      }
+      if (run_start < 0) {
+        run_start = x_start;
+      }
 
-    // Update the z-buffer value with the 1/w of this current pixel
-    z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+      bool covers_block = y_start == block_y_start && y_end == block_y_end;
+      for (int row = 0; covers_block && row < num_rows; row++) {
+        covers_block = has_span[row] && spans[row].x_start <= block_x_start &&
+                       spans[row].x_end >= block_x_end;
+      }
+      if (covers_block) {
+        // Every pixel is now at most as far as the triangle in the block
+        float max_depth = 1 - min_inv_w;
+        if (max_depth < hiz_buffer[block]) hiz_buffer[block] = max_depth;
+      } else {
+        hiz_dirty[block] = 1;
+      }
+    }
+    if (run_start >= 0) {
+      draw_spans_run(setup, spans, has_span, num_rows, run_start, max_x,
+                     color, texture);
+    }
   }
+  count_triangle_stats(setup, texture);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Function to draw the textured pixel at position x and y using interpolation
+// Draw a filled triangle with a solid color using the half-space method
 ///////////////////////////////////////////////////////////////////////////////
-void draw_triangle_texel(int x, int y, uint32_t* texture, vec4_t point_a,
-                         vec4_t point_b, vec4_t point_c, tex2_t uv_a,
-                         tex2_t uv_b, tex2_t uv_c) {
-  vec2_t p = {x, y};
-  vec2_t a = vec2_from_vec4(point_a);
-  vec2_t b = vec2_from_vec4(point_b);
-  vec2_t c = vec2_from_vec4(point_c);
-
-  vec3_t weights = barycentric_weights(a, b, c, p);
-
-  float alpha = weights.x;
-  float beta = weights.y;
-  float gamma = weights.z;
-
-  // Variables to store the interpolated values of U,V, and also 1/w for the
-  // current pixel
-  float interpolated_u;
-  float interpolated_v;
-  float interpolated_reciprocal_w;
-
-  // Perform the interpolation of all U/w and V/w values using barycentric
-  // weights and a factor of 1/w
-  interpolated_u = (uv_a.u / point_a.w) * alpha + (uv_b.u / point_b.w) * beta +
-                   (uv_c.u / point_c.w) * gamma;
-  interpolated_v = (uv_a.v / point_a.w) * alpha + (uv_b.v / point_b.w) * beta +
-                   (uv_c.v / point_c.w) * gamma;
-
-  // Also interpolate the value of 1/w for the current pixel
-  interpolated_reciprocal_w = (1.0 / point_a.w) * alpha +
-                              (1.0 / point_b.w) * beta +
-                              (1.0 / point_c.w) * gamma;
-
-  // Now we can divide back both interpolated values by 1/w
-  interpolated_u /= interpolated_reciprocal_w;
-  interpolated_v /= interpolated_reciprocal_w;
-
-  // Map the UV coordinate to the full texture width and height
-  int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-  int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-
-  // adjust 1/w so the pixels that are closer to the camera have smaller values
-  interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
-
-  // only draw the pixel if the depth value is less than the one previously
-  // stored in the z-buffer
-  if (interpolated_reciprocal_w < z_buffer[(window_width * y + x)]) {
-    draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+//
+//          (x0,y0)
+//            / \
+//           /   \
+//          / +++ \
+//         / +++++ \
+//        /  +++++  \
+//   (x1,y1)------(x2,y2)
+//
+// A pixel is inside the triangle when it is on the inner side of all three
+// edges. We walk the bounding box row by row, find the span of pixels inside
+// the triangle and let the span kernel z-test them, stepping 1/w with
+// additions only.
+//
+///////////////////////////////////////////////////////////////////////////////
+void draw_filled_triangle(float x0, float y0, float w0, float x1, float y1,
+                          float w1, float x2, float y2, float w2,
+                          uint32_t color) {
+  draw_filled_triangle_clipped(x0, y0, w0, x1, y1, w1, x2, y2, w2, color,
+                               screen_rect());
+}
 
-    // update the z-buffer value with the 1/w of this current pixel
-    z_buffer[(window_width * y + x)] = interpolated_reciprocal_w;
+void draw_filled_triangle_clipped(float x0, float y0, float w0, float x1,
+                                  float y1, float w1, float x2, float y2,
+                                  float w2, uint32_t color, rect_t clip) {
+  triangle_setup_t setup;
+  if (!setup_triangle(&setup, x0, y0, w0, 0, 0, x1, y1, w1, 0, 0, x2, y2, w2, 0,
+                      0, clip)) {
+    return;
   }
+
+  rasterize_triangle(&setup, color, NULL);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a textured triangle based on a texture array of colors.
-// We split the original triangle in two, half flat-bottom and half flat-top.
 ///////////////////////////////////////////////////////////////////////////////
 //
 //        v0
@@ -366,101 +565,246 @@ void draw_triangle_texel(int x, int y, uint32_t* texture, vec4_t point_a,
 //                   \
 //                    v2
 //
+// Same half-space walk as draw_filled_triangle, the span kernel additionally
+// steps u/w and v/w. Dividing them by the interpolated 1/w gives the
+// perspective correct texture coordinates of the pixel.
+//
 ///////////////////////////////////////////////////////////////////////////////
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0,
-                            float v0, int x1, int y1, float z1, float w1,
-                            float u1, float v1, int x2, int y2, float z2,
-                            float w2, float u2, float v2, uint32_t* texture) {
-  // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
-  if (y0 > y1) {
-    int_swap(&y0, &y1);
-    int_swap(&x0, &x1);
-    float_swap(&z0, &z1);
-    float_swap(&w0, &w1);
-    float_swap(&u0, &u1);
-    float_swap(&v0, &v1);
-  }
-  if (y1 > y2) {
-    int_swap(&y1, &y2);
-    int_swap(&x1, &x2);
-    float_swap(&z1, &z2);
-    float_swap(&w1, &w2);
-    float_swap(&u1, &u2);
-    float_swap(&v1, &v2);
-  }
-  if (y0 > y1) {
-    int_swap(&y0, &y1);
-    int_swap(&x0, &x1);
-    float_swap(&z0, &z1);
-    float_swap(&w0, &w1);
-    float_swap(&u0, &u1);
-    float_swap(&v0, &v1);
-  }
+void draw_textured_triangle(float x0, float y0, float w0, float u0, float v0,
+                            float x1, float y1, float w1, float u1, float v1,
+                            float x2, float y2, float w2, float u2, float v2,
+                            uint32_t* texture) {
+  draw_textured_triangle_clipped(x0, y0, w0, u0, v0, x1, y1, w1, u1, v1, x2, y2,
+                                 w2, u2, v2, texture, screen_rect());
+}
 
+void draw_textured_triangle_clipped(float x0, float y0, float w0, float u0,
+                                    float v0, float x1, float y1, float w1,
+                                    float u1, float v1, float x2, float y2,
+                                    float w2, float u2, float v2,
+                                    uint32_t* texture, rect_t clip) {
   // Flip the V component to account for inverted UV coordinates (V grows
   // downwards)
   v0 = 1.0 - v0;
   v1 = 1.0 - v1;
   v2 = 1.0 - v2;
 
-  // Create vector points and texture coords after we sort the vertices
-  vec4_t point_a = {x0, y0, z0, w0};
-  vec4_t point_b = {x1, y1, z1, w1};
-  vec4_t point_c = {x2, y2, z2, w2};
+  triangle_setup_t setup;
+  if (!setup_triangle(&setup, x0, y0, w0, u0, v0, x1, y1, w1, u1, v1, x2, y2,
+                      w2, u2, v2, clip)) {
+    return;
+  }
+
+  rasterize_triangle(&setup, 0, texture);
+}
+
+// Draw the vertex points of a projected triangle
+void draw_triangle_vertices(triangle_t* triangle, rect_t clip) {
+  screen_point_t* points = triangle->points;
+  float vw = 8.0;  // vertex width
+  for (int i = 0; i < 3; i++) {
+    draw_rect_clipped(points[i].x - vw / 2, points[i].y - vw / 2, vw, vw,
+                      0xFFFFFF00, clip);
+  }
+}
+
+// Draw the unfilled outline of a projected triangle
+void draw_triangle_wireframe(triangle_t* triangle, rect_t clip) {
+  screen_point_t* points = triangle->points;
+  draw_triangle_clipped(points[0].x, points[0].y, points[1].x, points[1].y,
+                        points[2].x, points[2].y, 0xFF000000, clip);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a projected triangle with all the enabled render modes
+///////////////////////////////////////////////////////////////////////////////
+//
+// Only the pixels inside the clip rectangle are touched, so the tiled
+// rasterizer can draw the same triangle into several tiles in parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void render_triangle(triangle_t* triangle, rect_t clip) {
+  screen_point_t* points = triangle->points;
+  tex2_t* texcoords = triangle->texcoords;
 
-  tex2_t uv_a = {u0, v0};
-  tex2_t uv_b = {u1, v1};
-  tex2_t uv_c = {u2, v2};
+  if (RENDER_VERTICES) {
+    draw_triangle_vertices(triangle, clip);
+  }
 
-  ///////////////////////////////////////////////////////
-  // Render the upper part of the triangle (flat-bottom)
-  ///////////////////////////////////////////////////////
-  float inv_slope_1 = 0;
-  float inv_slope_2 = 0;
+  if (RENDER_FILL) {
+    // Draw filled triangle
+    draw_filled_triangle_clipped(
+        points[0].x, points[0].y, points[0].w,  // vertex A
+        points[1].x, points[1].y, points[1].w,  // vertex B
+        points[2].x, points[2].y, points[2].w,  // vertex C
+        triangle->color, clip);
+  }
 
-  if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-  if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+  if (RENDER_TEXTURED) {
+    // Draw textured triangle
+    draw_textured_triangle_clipped(
+        points[0].x, points[0].y, points[0].w, texcoords[0].u,
+        texcoords[0].v,  // vertex A
+        points[1].x, points[1].y, points[1].w, texcoords[1].u,
+        texcoords[1].v,  // vertex B
+        points[2].x, points[2].y, points[2].w, texcoords[2].u,
+        texcoords[2].v,  // vertex C
+        mesh_texture, clip);
+  }
 
-  if (y1 - y0 != 0) {
-    for (int y = y0; y <= y1; y++) {
-      int x_start = x1 + (y - y1) * inv_slope_1;
-      int x_end = x0 + (y - y0) * inv_slope_2;
+  if (RENDER_WIREFRAME) {
+    draw_triangle_wireframe(triangle, clip);
+  }
+}
 
-      if (x_end < x_start) {
-        int_swap(&x_start, &x_end);  // swap if x_start is to the right of x_end
-      }
+// Count the triangles of a frame that the filled or textured modes rasterize,
+// and the ones they reject because they are degenerate or off screen. They
+// are counted once per triangle, however many tiles it is drawn into.
+void count_rasterized_triangles(triangle_t* triangles, int num_triangles) {
+  if (!RENDER_FILL && !RENDER_TEXTURED) {
+    return;
+  }
 
-      for (int x = x_start; x < x_end; x++) {
-        // Draw our pixel with the color that comes from the texture
-        draw_triangle_texel(x, y, texture, point_a, point_b, point_c, uv_a,
-                            uv_b, uv_c);
-      }
+  int num_rejected = 0;
+  for (int i = 0; i < num_triangles; i++) {
+    screen_point_t* points = triangles[i].points;
+    triangle_setup_t setup;
+    if (!setup_triangle(&setup, points[0].x, points[0].y, points[0].w, 0, 0,
+                        points[1].x, points[1].y, points[1].w, 0, 0,
+                        points[2].x, points[2].y, points[2].w, 0, 0,
+                        screen_rect())) {
+      num_rejected++;
     }
   }
+  count_pipeline_stat(STAT_TRIANGLES_RASTERIZED, num_triangles - num_rejected);
+  count_pipeline_stat(STAT_TRIANGLES_REJECTED, num_rejected);
+}
 
-  ///////////////////////////////////////////////////////
-  // Render the bottom part of the triangle (flat-top)
-  ///////////////////////////////////////////////////////
-  inv_slope_1 = 0;
-  inv_slope_2 = 0;
+///////////////////////////////////////////////////////////////////////////////
+// Draw projected triangles through the visibility buffer (deferred texturing)
+///////////////////////////////////////////////////////////////////////////////
+//
+// Drawing a triangle textures every pixel that passes the z-test at that
+// moment, even if a closer triangle drawn later overwrites it. This path
+// splits the work in two passes instead. The first one only rasterizes depth
+// and the id of the triangle (its index + 1, 0 means no triangle) into the
+// visibility buffer. The second one walks the pixels and shades each covered
+// one exactly once, reconstructing 1/w and the UVs from the triangle, so the
+// shading cost depends on the number of pixels and not on the overdraw.
+//
+// The shading pass only walks the bounding box of the pixels that got an id
+// and clears them again. Vertices and wireframes are drawn at the end, on top
+// of all the filled triangles.
+//
+// indices selects the triangles to draw, or NULL to draw all of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+#define SHADING_CACHE_SIZE 64
+
+// Rasterize the id of a triangle and grow bounds by its bounding box
+void draw_triangle_id_clipped(triangle_t* triangle, uint32_t id, rect_t clip,
+                              rect_t* bounds) {
+  screen_point_t* points = triangle->points;
+
+  triangle_setup_t setup;
+  if (!setup_triangle(&setup, points[0].x, points[0].y, points[0].w, 0, 0,
+                      points[1].x, points[1].y, points[1].w, 0, 0, points[2].x,
+                      points[2].y, points[2].w, 0, 0, clip)) {
+    return;
+  }
 
-  if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-  if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+  setup.target = visibility_buffer;
+  setup.target_pitch = window_width;
+  rasterize_triangle(&setup, id, NULL);
 
-  if (y2 - y1 != 0) {
-    for (int y = y1; y <= y2; y++) {
-      int x_start = x1 + (y - y1) * inv_slope_1;
-      int x_end = x0 + (y - y0) * inv_slope_2;
+  if (setup.min_x < bounds->min_x) bounds->min_x = setup.min_x;
+  if (setup.min_y < bounds->min_y) bounds->min_y = setup.min_y;
+  if (setup.max_x > bounds->max_x) bounds->max_x = setup.max_x;
+  if (setup.max_y > bounds->max_y) bounds->max_y = setup.max_y;
+}
 
-      if (x_end < x_start) {
-        int_swap(&x_start, &x_end);  // swap if x_start is to the right of x_end
+// Set up the attributes of a textured triangle, the same way as
+// draw_textured_triangle_clipped does
+bool setup_textured_triangle(triangle_setup_t* setup, triangle_t* triangle) {
+  screen_point_t* points = triangle->points;
+  tex2_t* texcoords = triangle->texcoords;
+
+  return setup_triangle(setup, points[0].x, points[0].y, points[0].w,
+                        texcoords[0].u, 1.0 - texcoords[0].v, points[1].x,
+                        points[1].y, points[1].w, texcoords[1].u,
+                        1.0 - texcoords[1].v, points[2].x, points[2].y,
+                        points[2].w, texcoords[2].u, 1.0 - texcoords[2].v,
+                        screen_rect());
+}
+
+void shade_visibility_buffer(triangle_t* triangles, rect_t clip) {
+  // Small cache of triangle setups indexed by the low bits of the id, the
+  // pixels of a triangle are spread over several rows
+  triangle_setup_t setups[SHADING_CACHE_SIZE];
+  uint32_t setup_ids[SHADING_CACHE_SIZE] = {0};
+  int pixels_shaded = 0;
+  int texels_fetched = 0;
+
+  for (int y = clip.min_y; y <= clip.max_y; y++) {
+    uint32_t* ids = visibility_buffer + window_width * y;
+    uint32_t* colors = framebuffer.pixels + framebuffer.pitch * y;
+
+    for (int x = clip.min_x; x <= clip.max_x; x++) {
+      uint32_t id = ids[x];
+      if (id == 0) {
+        continue;
+      }
+      ids[x] = 0;
+
+      triangle_t* triangle = &triangles[id - 1];
+      if (RENDER_FILL || !mesh_texture) {
+        colors[x] = triangle->color;
+        pixels_shaded++;
+        continue;
       }
 
-      for (int x = x_start; x < x_end; x++) {
-        // Draw our pixel with the color that comes from the texture
-        draw_triangle_texel(x, y, texture, point_a, point_b, point_c, uv_a,
-                            uv_b, uv_c);
+      triangle_setup_t* setup = &setups[id % SHADING_CACHE_SIZE];
+      if (setup_ids[id % SHADING_CACHE_SIZE] != id) {
+        if (!setup_textured_triangle(setup, triangle)) {
+          continue;
+        }
+        setup_ids[id % SHADING_CACHE_SIZE] = id;
       }
+
+      float dx = x - setup->min_x;
+      float dy = y - setup->min_y;
+      float inv_w = setup->inv_w + setup->inv_w_dx * dx + setup->inv_w_dy * dy;
+      float u_w = setup->u_w + setup->u_w_dx * dx + setup->u_w_dy * dy;
+      float v_w = setup->v_w + setup->v_w_dx * dx + setup->v_w_dy * dy;
+      float w = 1 / inv_w;
+      colors[x] = mesh_texture[texel_index(u_w * w, v_w * w)];
+      pixels_shaded++;
+      texels_fetched++;
     }
   }
-}
\ No newline at end of file
+  count_pipeline_stat(STAT_PIXELS_SHADED, pixels_shaded);
+  count_pipeline_stat(STAT_TEXELS_FETCHED, texels_fetched);
+}
+
+void render_triangles_visibility(triangle_t* triangles, int* indices,
+                                 int num_triangles, rect_t clip) {
+  if (RENDER_FILL || RENDER_TEXTURED) {
+    rect_t bounds = {clip.max_x + 1, clip.max_y + 1, clip.min_x - 1,
+                     clip.min_y - 1};
+    for (int i = 0; i < num_triangles; i++) {
+      int index = indices ? indices[i] : i;
+      draw_triangle_id_clipped(&triangles[index], index + 1, clip, &bounds);
+    }
+    shade_visibility_buffer(triangles, bounds);
+  }
+
+  for (int i = 0; i < num_triangles; i++) {
+    triangle_t* triangle = &triangles[indices ? indices[i] : i];
+    if (RENDER_VERTICES) {
+      draw_triangle_vertices(triangle, clip);
+    }
+    if (RENDER_WIREFRAME) {
+      draw_triangle_wireframe(triangle, clip);
+    }
+  }
+}
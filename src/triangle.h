@@ -3,22 +3,29 @@
 
 #include <stdint.h>
 
+#include "display.h"
 #include "texture.h"
 #include "vector.h"
 
+// Indexed face: the corners index the vertex buffer of the mesh, where every
+// vertex holds a position and texture coordinates
 typedef struct {
   int a;
   int b;
   int c;
-  tex2_t a_uv;
-  tex2_t b_uv;
-  tex2_t c_uv;
-  uint32_t color;
+  uint32_t color;  // flat color, the only material of a face
 } face_t;
 
-// store projected points of the face
+// Projected vertex: position on the screen and w of the vertex in camera
+// space. The projected z is not kept, the depth is interpolated from 1/w.
+typedef struct {
+  float x, y, w;
+} screen_point_t;
+
+// store projected points of the face, packed into 64 bytes so the queue of
+// triangles to render streams one cache line per triangle
 typedef struct {
-  vec4_t points[3];
+  screen_point_t points[3];
   tex2_t texcoords[3];
   uint32_t color;
 } triangle_t;
@@ -26,13 +33,39 @@ typedef struct {
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
                    uint32_t color);
 
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1,
-                          float z1, float w1, int x2, int y2, float z2,
-                          float w2, uint32_t color);
+void draw_filled_triangle(float x0, float y0, float w0, float x1, float y1,
+                          float w1, float x2, float y2, float w2,
+                          uint32_t color);
+
+void draw_textured_triangle(float x0, float y0, float w0, float u0, float v0,
+                            float x1, float y1, float w1, float u1, float v1,
+                            float x2, float y2, float w2, float u2, float v2,
+                            uint32_t* texture);
+
+// Variants of the functions above that only touch the pixels inside clip
+void draw_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2,
+                           uint32_t color, rect_t clip);
+
+void draw_filled_triangle_clipped(float x0, float y0, float w0, float x1,
+                                  float y1, float w1, float x2, float y2,
+                                  float w2, uint32_t color, rect_t clip);
+
+void draw_textured_triangle_clipped(float x0, float y0, float w0, float u0,
+                                    float v0, float x1, float y1, float w1,
+                                    float u1, float v1, float x2, float y2,
+                                    float w2, float u2, float v2,
+                                    uint32_t* texture, rect_t clip);
+
+void draw_triangle_vertices(triangle_t* triangle, rect_t clip);
+void draw_triangle_wireframe(triangle_t* triangle, rect_t clip);
+void render_triangle(triangle_t* triangle, rect_t clip);
+void count_rasterized_triangles(triangle_t* triangles, int num_triangles);
 
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0,
-                            float v0, int x1, int y1, float z1, float w1,
-                            float u1, float v1, int x2, int y2, float z2,
-                            float w2, float u2, float v2, uint32_t* color);
+// Deferred texturing through the visibility buffer
+void draw_triangle_id_clipped(triangle_t* triangle, uint32_t id, rect_t clip,
+                              rect_t* bounds);
+void shade_visibility_buffer(triangle_t* triangles, rect_t clip);
+void render_triangles_visibility(triangle_t* triangles, int* indices,
+                                 int num_triangles, rect_t clip);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "vector.h"
 
 #include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 // Vector 2D Functions
 float vec2_length(vec2_t v) { return sqrt(v.x * v.x + v.y * v.y); };
@@ -110,4 +112,46 @@ vec3_t vec3_from_vec4(vec4_t v) {
 vec2_t vec2_from_vec4(vec4_t v) {
   vec2_t result = {v.x, v.y};
   return result;
-};
\ No newline at end of file
+};
+
+// Structure of arrays functions
+
+// Make room for at least capacity vectors, the previous contents are lost if
+// the arrays have to grow. New arrays are zeroed, so the padding holds zeros.
+bool vec4_soa_reserve(vec4_soa_t* soa, int capacity) {
+  if (soa->data && soa->capacity >= capacity) {
+    return true;
+  }
+
+  int lanes = VEC4_SOA_ALIGNMENT / sizeof(float);
+  int padded = (capacity + lanes - 1) / lanes * lanes;
+  void* data = calloc(4 * padded * sizeof(float) + VEC4_SOA_ALIGNMENT, 1);
+  if (!data) {
+    return false;
+  }
+  free(soa->data);
+
+  // Round the start of the first array up to the alignment, the size of every
+  // array is a multiple of it so the others are aligned as well
+  uintptr_t address = (uintptr_t)data + VEC4_SOA_ALIGNMENT - 1;
+  float* arrays = (float*)(address - address % VEC4_SOA_ALIGNMENT);
+  soa->x = arrays;
+  soa->y = arrays + padded;
+  soa->z = arrays + 2 * padded;
+  soa->w = arrays + 3 * padded;
+  soa->data = data;
+  soa->capacity = padded;
+  return true;
+}
+
+void vec4_soa_free(vec4_soa_t* soa) {
+  free(soa->data);
+  soa->x = soa->y = soa->z = soa->w = NULL;
+  soa->data = NULL;
+  soa->capacity = 0;
+}
+
+vec4_t vec4_soa_get(vec4_soa_t* soa, int i) {
+  vec4_t result = {soa->x[i], soa->y[i], soa->z[i], soa->w[i]};
+  return result;
+}
@@ -1,6 +1,8 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <stdbool.h>
+
 typedef struct {
   float x, y;
 } vec2_t;
@@ -13,6 +15,19 @@ typedef struct {
   float x, y, z, w;
 } vec4_t;
 
+// Structure of arrays of 4D vectors, used to process many vectors at once
+// with SIMD. The arrays are aligned to VEC4_SOA_ALIGNMENT bytes and padded to
+// a multiple of VEC4_SOA_ALIGNMENT / sizeof(float) elements.
+#define VEC4_SOA_ALIGNMENT 32
+typedef struct {
+  float* x;
+  float* y;
+  float* z;
+  float* w;
+  void* data;    // allocation that holds the four arrays
+  int capacity;  // number of vectors that fit in the arrays
+} vec4_soa_t;
+
 // Vector 2D Functions
 float vec2_length(vec2_t v);
 vec2_t vec2_add(vec2_t a, vec2_t b);
@@ -40,4 +55,9 @@ void vec3_normalize(vec3_t* v);
 vec4_t vec4_from_vec3(vec3_t v);
 vec3_t vec3_from_vec4(vec4_t v);
 vec2_t vec2_from_vec4(vec4_t v);
+
+// Structure of arrays functions
+bool vec4_soa_reserve(vec4_soa_t* soa, int capacity);
+void vec4_soa_free(vec4_soa_t* soa);
+vec4_t vec4_soa_get(vec4_soa_t* soa, int i);
 #endif
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "vertex_cache.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "mesh.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Vertex cache optimization
+///////////////////////////////////////////////////////////////////////////////
+//
+// The faces are reordered with Tom Forsyth's linear-speed vertex cache
+// optimization: a simulated LRU cache gives every vertex a score, higher for
+// recently used vertices and for vertices with few faces left, and the face
+// with the best total score among the ones touching the cache is emitted next.
+// When no face touches the cache the next face left in the old order starts a
+// new strip of faces.
+//
+// The vertices are then reordered by first use, so walking the faces reads
+// the vertex buffer mostly sequentially.
+//
+// The average cache miss ratio (ACMR) is the number of vertices transformed
+// per face by a FIFO cache of VERTEX_CACHE_SIZE entries: 3 when nothing is
+// reused, around 0.6 for a well ordered mesh.
+//
+///////////////////////////////////////////////////////////////////////////////
+#define CACHE_DECAY_POWER 1.5
+#define LAST_FACE_SCORE 0.75
+#define VALENCE_BOOST_SCALE 2.0
+#define VALENCE_BOOST_POWER 0.5
+
+float get_mesh_acmr(void) {
+  int num_faces = array_length(mesh.faces);
+  if (num_faces == 0) {
+    return 0;
+  }
+
+  int num_vertices = array_length(mesh.vertices);
+  int* cached_at = (int*)malloc(sizeof(int) * (num_vertices + 1));
+  for (int v = 0; v < num_vertices; v++) {
+    cached_at[v] = -VERTEX_CACHE_SIZE - 1;
+  }
+
+  // A vertex is in the FIFO while fewer than VERTEX_CACHE_SIZE misses
+  // happened since it was pushed
+  int misses = 0;
+  for (int i = 0; i < num_faces; i++) {
+    int corners[3] = {mesh.faces[i].a, mesh.faces[i].b, mesh.faces[i].c};
+    for (int j = 0; j < 3; j++) {
+      if (misses - cached_at[corners[j]] > VERTEX_CACHE_SIZE) {
+        cached_at[corners[j]] = misses++;
+      }
+    }
+  }
+
+  free(cached_at);
+  return (float)misses / num_faces;
+}
+
+float get_vertex_score(int cache_position, int faces_left) {
+  if (faces_left == 0) {
+    return -1;  // nothing left to draw with this vertex
+  }
+
+  float score = 0;
+  if (cache_position < 0) {
+    // not in the cache
+  } else if (cache_position < 3) {
+    // used by the last face, a fixed score so the next face does not simply
+    // reuse its two most recent vertices
+    score = LAST_FACE_SCORE;
+  } else {
+    float scale = 1.0 / (VERTEX_CACHE_SIZE - 3);
+    score = powf(1.0 - (cache_position - 3) * scale, CACHE_DECAY_POWER);
+  }
+
+  // Favor the vertices with few faces left, so lone faces are not left behind
+  score += VALENCE_BOOST_SCALE * powf(faces_left, -VALENCE_BOOST_POWER);
+  return score;
+}
+
+// Reorder the faces for the vertex cache
+void optimize_face_order(int num_vertices, int num_faces) {
+  face_t* faces = mesh.faces;
+
+  // Faces of every vertex: face_lists[first_face[v]..+faces_left[v]] are the
+  // faces not emitted yet
+  int* first_face = (int*)calloc(num_vertices + 1, sizeof(int));
+  int* faces_left = (int*)calloc(num_vertices + 1, sizeof(int));
+  int* face_lists = (int*)malloc(sizeof(int) * (3 * num_faces + 1));
+  for (int i = 0; i < num_faces; i++) {
+    faces_left[faces[i].a]++;
+    faces_left[faces[i].b]++;
+    faces_left[faces[i].c]++;
+  }
+  for (int v = 0, sum = 0; v < num_vertices; v++) {
+    first_face[v] = sum;
+    sum += faces_left[v];
+    faces_left[v] = 0;
+  }
+  for (int i = 0; i < num_faces; i++) {
+    int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+    for (int j = 0; j < 3; j++) {
+      int v = corners[j];
+      face_lists[first_face[v] + faces_left[v]++] = i;
+    }
+  }
+
+  int* cache_position = (int*)malloc(sizeof(int) * (num_vertices + 1));
+  float* vertex_scores = (float*)malloc(sizeof(float) * (num_vertices + 1));
+  for (int v = 0; v < num_vertices; v++) {
+    cache_position[v] = -1;
+    vertex_scores[v] = get_vertex_score(-1, faces_left[v]);
+  }
+
+  bool* emitted = (bool*)calloc(num_faces + 1, sizeof(bool));
+
+  // The cache has room for the 3 vertices of the new face on top of the old
+  // entries, the ones pushed out past VERTEX_CACHE_SIZE still get rescored
+  int cache[VERTEX_CACHE_SIZE + 3];
+  int cache_size = 0;
+  face_t* ordered = (face_t*)malloc(sizeof(face_t) * (num_faces + 1));
+  int next_unemitted = 0;
+  int best_face = -1;
+
+  for (int n = 0; n < num_faces; n++) {
+    if (best_face < 0) {
+      while (emitted[next_unemitted]) next_unemitted++;
+      best_face = next_unemitted;
+    }
+
+    face_t face = faces[best_face];
+    ordered[n] = face;
+    emitted[best_face] = true;
+
+    // Remove the face from the lists of its vertices, and move them to the
+    // front of the cache
+    int corners[3] = {face.a, face.b, face.c};
+    int new_cache[VERTEX_CACHE_SIZE + 3];
+    int new_size = 0;
+    for (int j = 0; j < 3; j++) {
+      int v = corners[j];
+      int* list = face_lists + first_face[v];
+      for (int k = 0; k < faces_left[v]; k++) {
+        if (list[k] == best_face) {
+          list[k] = list[--faces_left[v]];
+          break;
+        }
+      }
+      bool repeated = new_size > 0 && (new_cache[0] == v ||
+                                       new_cache[new_size - 1] == v);
+      if (!repeated) {
+        new_cache[new_size++] = v;  // degenerate faces repeat a vertex
+      }
+    }
+    for (int k = 0; k < cache_size; k++) {
+      int v = cache[k];
+      if (v != corners[0] && v != corners[1] && v != corners[2]) {
+        new_cache[new_size++] = v;
+      }
+    }
+
+    // Rescore the vertices whose cache position changed and their faces, and
+    // pick the best of these faces as the next one
+    best_face = -1;
+    float best_score = -1;
+    for (int k = 0; k < new_size; k++) {
+      int v = new_cache[k];
+      cache_position[v] = k < VERTEX_CACHE_SIZE ? k : -1;
+      vertex_scores[v] = get_vertex_score(cache_position[v], faces_left[v]);
+    }
+    for (int k = 0; k < new_size; k++) {
+      int v = new_cache[k];
+      int* list = face_lists + first_face[v];
+      for (int f = 0; f < faces_left[v]; f++) {
+        face_t* other = &faces[list[f]];
+        float score = vertex_scores[other->a] + vertex_scores[other->b] +
+                      vertex_scores[other->c];
+        if (score > best_score) {
+          best_score = score;
+          best_face = list[f];
+        }
+      }
+    }
+
+    cache_size = new_size < VERTEX_CACHE_SIZE ? new_size : VERTEX_CACHE_SIZE;
+    memcpy(cache, new_cache, sizeof(int) * cache_size);
+  }
+
+  memcpy(faces, ordered, sizeof(face_t) * num_faces);
+  free(ordered);
+  free(emitted);
+  free(vertex_scores);
+  free(cache_position);
+  free(face_lists);
+  free(faces_left);
+  free(first_face);
+}
+
+// Renumber the vertices in the order the faces first use them, the unused
+// ones go last
+void optimize_vertex_order(int num_vertices, int num_faces) {
+  int* remap = (int*)malloc(sizeof(int) * (num_vertices + 1));
+  for (int v = 0; v < num_vertices; v++) remap[v] = -1;
+
+  int next = 0;
+  for (int i = 0; i < num_faces; i++) {
+    int* corners[3] = {&mesh.faces[i].a, &mesh.faces[i].b, &mesh.faces[i].c};
+    for (int j = 0; j < 3; j++) {
+      if (remap[*corners[j]] < 0) remap[*corners[j]] = next++;
+      *corners[j] = remap[*corners[j]];
+    }
+  }
+  for (int v = 0; v < num_vertices; v++) {
+    if (remap[v] < 0) remap[v] = next++;
+  }
+
+  vec3_t* vertices = (vec3_t*)malloc(sizeof(vec3_t) * (num_vertices + 1));
+  tex2_t* texcoords = (tex2_t*)malloc(sizeof(tex2_t) * (num_vertices + 1));
+  for (int v = 0; v < num_vertices; v++) {
+    vertices[remap[v]] = mesh.vertices[v];
+    texcoords[remap[v]] = mesh.texcoords[v];
+  }
+  memcpy(mesh.vertices, vertices, sizeof(vec3_t) * num_vertices);
+  memcpy(mesh.texcoords, texcoords, sizeof(tex2_t) * num_vertices);
+
+  free(texcoords);
+  free(vertices);
+  free(remap);
+}
+
+// Reorder the faces and the vertices of the mesh for the vertex cache. The
+// mesh must own its arrays, a mesh mapped from the cache is read-only.
+void optimize_vertex_cache(void) {
+  int num_vertices = array_length(mesh.vertices);
+  int num_faces = array_length(mesh.faces);
+  optimize_face_order(num_vertices, num_faces);
+  optimize_vertex_order(num_vertices, num_faces);
+  update_vertex_stream();
+}
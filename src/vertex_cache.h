@@ -0,0 +1,10 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+// Number of vertices of the simulated post-transform cache
+#define VERTEX_CACHE_SIZE 32
+
+float get_mesh_acmr(void);
+void optimize_vertex_cache(void);
+
+#endif